@@ -0,0 +1,32 @@
+#include "AllocationCounter.h"
+
+#ifdef AUDIOROUTER_COUNT_ALLOCATIONS
+
+#include <stdlib.h>
+#include <new>
+
+static thread_local uint64_t s_threadAllocationCount = 0;
+
+uint64_t ThreadAllocationCount() {
+  return s_threadAllocationCount;
+}
+
+// The array, nothrow and sized forms all forward to these two in the MSVC runtime.
+void* operator new(size_t size) {
+  s_threadAllocationCount++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+// Replaced as well so GCC and Clang, which call it directly, can't pair it with a foreign heap.
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Debug hook for proving the audio path doesn't allocate. When AUDIOROUTER_COUNT_ALLOCATIONS is
+// defined, this module replaces the global operator new and counts calls per thread; the capture
+// callback compares the count before and after each invocation. Only allocations made through
+// this module's C++ runtime are seen, not those made inside the audio engine.
+#ifdef AUDIOROUTER_COUNT_ALLOCATIONS
+uint64_t ThreadAllocationCount();
+#else
+inline uint64_t ThreadAllocationCount() { return 0; }
+#endif
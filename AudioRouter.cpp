@@ -4,6 +4,7 @@
 #include <Windows.h>
 #include <sstream>
 #include "LoopbackCapture.h"
+#include "ControlChannel.h"
 #include <vector>
 #include <map>
 #include <psapi.h>
@@ -93,71 +94,336 @@ BOOL WINAPI DllMain(
   }
   return TRUE;  // Successful DLL_PROCESS_ATTACH.
 }
+// Route changes that the audio thread can't pick up by itself. Written by the control channel
+// thread and picked up by RouterThread, which applies output changes to the running route where it
+// can and restarts capture for the rest.
+struct RouteControlState {
+  wil::critical_section lock;
+  wil::unique_event_nothrow hRouteChanged;
+
+  RouteSource source;
+  bool sourceChanged = false;
+  RouteOutput output;
+  bool outputChanged = false;
+  uint32_t outputVersion = 0; // Bumped on every output change, so RouterThread can tell if it raced one
+  LONGLONG outputRequestQpc = 0; // When the latest output change was accepted
+};
+
+// Flags an output change for RouterThread. Caller must hold control.lock.
+static void NoteOutputChanged(RouteControlState& control) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  control.outputChanged = true;
+  control.outputVersion++;
+  control.outputRequestQpc = now.QuadPart;
+  control.hRouteChanged.SetEvent();
+}
+
+std::wstring HandleControlCommand(const std::wstring& command, CLoopbackCapture& loopbackCapture, RouteControlState& control) {
+  std::wstring verb, argument;
+  SplitControlCommand(command, verb, argument);
+
+  if (verb == L"status") {
+    return loopbackCapture.GetStatus();
+
+  } else if (verb == L"stats") {
+    if (argument == L"reset") {
+      loopbackCapture.ResetStats();
+      return L"ok";
+    }
+    return loopbackCapture.GetStats();
+
+  } else if (verb == L"gain") {
+    // Applied in place by the audio thread, no restart needed.
+    float gainDb;
+    if (!ParseGainDb(argument, gainDb))
+      return L"error: gain expects a value in dB between -96 and 24";
+    loopbackCapture.SetGainDb(gainDb);
+    return L"ok";
+
+  } else if (verb == L"qos") {
+    // Applied in place, like gain.
+    if (argument != L"on" && argument != L"off")
+      return L"error: qos expects on or off";
+    loopbackCapture.SetQosEnabled(argument == L"on");
+    return L"ok";
+
+  } else if (verb == L"source") {
+    RouteSource source;
+    if (!ParseRouteSource(argument.c_str(), GetCurrentProcessId(), source))
+      return L"error: source expects a PID, an image name or *";
+    if (source.mode == RouteSource::Mode::IncludeProcessTree && !source.matchesByName()) {
+      // Check the PID here, so a bad one gets an error instead of an "ok" the router can't act on.
+      wil::unique_handle hProcess(OpenProcess(SYNCHRONIZE, false, source.pid));
+      if (!hProcess)
+        return L"error: no process with that PID can be opened";
+    }
+    auto lock = control.lock.lock();
+    control.source = source;
+    control.sourceChanged = true;
+    control.hRouteChanged.SetEvent();
+    return L"ok";
+
+  } else if (verb == L"device") {
+    auto lock = control.lock.lock();
+    control.output.deviceName = argument;
+    NoteOutputChanged(control);
+    return L"ok";
+
+  } else if (verb == L"stream") {
+    std::wstring host, port;
+    if (argument != L"off" && !ParseStreamDestination(argument, host, port))
+      return L"error: stream expects host:port, [IPv6 address]:port or off";
+    auto lock = control.lock.lock();
+    control.output.streamDestination = (argument == L"off") ? std::wstring() : argument;
+    NoteOutputChanged(control);
+    return L"ok";
+
+  } else if (verb == L"trace") {
+    // "trace <MB>" starts recording, "trace save <path>" stops and writes the trace.
+    if (argument.compare(0, 5, L"save ") == 0) {
+      HRESULT hr = loopbackCapture.SavePacketTrace(argument.substr(5));
+      return SUCCEEDED(hr) ? L"ok" : L"error: no trace in progress, or the file couldn't be written";
+    }
+    wchar_t* endptr = nullptr;
+    unsigned long capacityMB = wcstoul(argument.c_str(), &endptr, 10);
+    if (argument.empty() || *endptr != 0 || capacityMB < 1 || capacityMB > 1024)
+      return L"error: trace expects a buffer size in MB between 1 and 1024, or save <path>";
+    loopbackCapture.StartPacketTrace((size_t) capacityMB * 1024 * 1024);
+    return L"ok";
+
+  } else if (verb == L"replay") {
+    // "replay <minutes>" keeps a rolling history, "replay save [seconds] <path>" writes the most
+    // recent audio (all of it by default) to a WAV file, "replay off" discards it.
+    if (argument == L"off") {
+      loopbackCapture.StopReplayBuffer();
+      return L"ok";
+    }
+    if (argument.compare(0, 5, L"save ") == 0) {
+      std::wstring path = argument.substr(5);
+      uint32_t seconds = UINT32_MAX;
+      size_t pathStart = path.find(L' ');
+      if (pathStart != std::wstring::npos && pathStart > 0 && path.find_first_not_of(L"0123456789") == pathStart) {
+        seconds = wcstoul(path.c_str(), nullptr, 10);
+        path = path.substr(pathStart + 1);
+      }
+      HRESULT hr = loopbackCapture.SaveReplay(path, seconds);
+      return SUCCEEDED(hr) ? L"ok" : L"error: no replay history yet, or the file couldn't be written";
+    }
+    wchar_t* endptr = nullptr;
+    unsigned long minutes = wcstoul(argument.c_str(), &endptr, 10);
+    if (argument.empty() || *endptr != 0 || minutes < 1 || minutes > 120)
+      return L"error: replay expects a history length in minutes between 1 and 120, save [seconds] <path> or off";
+    HRESULT hr = loopbackCapture.StartReplayBuffer(minutes * 60);
+    return SUCCEEDED(hr) ? L"ok" : L"error: the route has no float capture format yet";
+
+  } else if (verb == L"latency") {
+    if (argument != L"interactive" && argument != L"relaxed")
+      return L"error: latency expects interactive or relaxed";
+    auto lock = control.lock.lock();
+    control.output.latency = (argument == L"relaxed") ? LatencyClass::Relaxed : LatencyClass::Interactive;
+    NoteOutputChanged(control);
+    return L"ok";
+
+  } else if (verb == L"exclusive") {
+    if (argument != L"on" && argument != L"off")
+      return L"error: exclusive expects on or off";
+    auto lock = control.lock.lock();
+    control.output.exclusive = (argument == L"on");
+    NoteOutputChanged(control);
+    return L"ok";
+
+  } else if (verb == L"fault") {
+    CLoopbackCapture::RouteFault fault;
+    if (argument == L"capture")
+      fault = CLoopbackCapture::RouteFault::Capture;
+    else if (argument == L"render")
+      fault = CLoopbackCapture::RouteFault::Render;
+    else if (argument == L"stall")
+      fault = CLoopbackCapture::RouteFault::Stall;
+    else
+      return L"error: fault expects capture, render or stall";
+    HRESULT hr = loopbackCapture.InjectFault(fault);
+    return SUCCEEDED(hr) ? L"ok" : L"error: the route isn't capturing, or has no render device";
+
+  } else if (verb == L"buffer") {
+    uint32_t bufferMs;
+    if (!ParseRenderBufferMs(argument, bufferMs))
+      return L"error: buffer expects a render buffer length in milliseconds between 1 and 2000";
+    auto lock = control.lock.lock();
+    control.output.renderBufferMs = bufferMs;
+    NoteOutputChanged(control);
+    return L"ok";
+  }
+
+  return L"error: unknown command. Commands: status, stats [reset], gain <dB>, qos <on|off>, source <pid|image|*>, device <name>, buffer <ms>, exclusive <on|off>, latency <interactive|relaxed>, stream <host:port|[address]:port|off>, trace <MB>|save <path>, replay <minutes>|save [seconds] <path>|off, fault <capture|render|stall>";
+}
+
+// Applies a pending output change to the running route in place, if nothing else changed and the
+// route can take it without a restart. Returns false if the route has to be restarted.
+static bool RetuneRunningRoute(CLoopbackCapture& loopbackCapture, RouteControlState& control) {
+  RouteOutput output;
+  uint32_t outputVersion;
+  LONGLONG requestQpc;
+  {
+    auto lock = control.lock.lock();
+    if (control.sourceChanged)
+      return false;
+    if (!control.outputChanged)
+      return true; // Already applied along with an earlier change.
+    output = control.output;
+    outputVersion = control.outputVersion;
+    requestQpc = control.outputRequestQpc;
+  }
+
+  if (loopbackCapture.RetuneOutput(output) != S_OK)
+    return false;
+  loopbackCapture.RecordOutputApplyLatency(requestQpc);
+
+  // A change that came in while we were switching has set the event again and is picked up next.
+  auto lock = control.lock.lock();
+  if (control.outputVersion == outputVersion)
+    control.outputChanged = false;
+  return true;
+}
+
 extern "C" __declspec(dllexport) DWORD __stdcall RouterThread(LPWSTR sourceSpecifier) {
   try {
     THROW_IF_FAILED(Windows::Foundation::Initialize(RO_INIT_MULTITHREADED));
     //OutputDebugStringA("RouterThread");
     //OutputDebugStringW(sourceSpecifier);
 
-    DWORD pid = 0;
-    bool attachByName = false;
-    {
-      wchar_t* endptr = nullptr;
-      pid = wcstoul(sourceSpecifier, &endptr, 10);
-      if (*endptr != 0) { // conversion failed
-        pid = 0;
-        attachByName = true;
-      }
+    RouteSource source;
+    if (!ParseRouteSource(sourceSpecifier, GetCurrentProcessId(), source)) {
+      OutputDebugStringA("AudioRouter: Empty source specifier.");
+      return 0;
     }
 
+    RouteControlState control;
+    THROW_IF_FAILED(control.hRouteChanged.create(wil::EventOptions::None));
+    control.source = source;
+
     CLoopbackCapture loopbackCapture;
 
+    CControlChannel controlChannel(GetCurrentProcessId(), [&](const std::wstring& command) {
+      return HandleControlCommand(command, loopbackCapture, control);
+    });
 
-    if (attachByName) {
-      while (true) {
-        wil::unique_handle hProcess;
+    LONGLONG outputRequestQpc = 0; // Output change the next start applies, if any
+    while (true) {
+      wil::unique_handle hProcess;
+      DWORD pid = source.pid;
+      bool startCapture = true;
 
-        while (!pid && !hProcess) {
-          UpdatePIDMap();
-          pid = FindPID(sourceSpecifier);
-          if (pid == 0) {
-            Sleep(1000);
-            continue;
+      if (source.mode == RouteSource::Mode::IncludeProcessTree) {
+        if (source.matchesByName()) {
+          // Wait for the source to start, while still accepting route changes.
+          while (!hProcess) {
+            UpdatePIDMap();
+            pid = FindPID(source.imageName.c_str());
+            if (pid != 0) {
+              hProcess.reset(OpenProcess(SYNCHRONIZE, false, pid));
+              if (!hProcess) {
+                std::wstringstream ss;
+                ss << L"AudioRouter: OpenProcess() failed for PID " << pid;
+                OutputDebugStringW(ss.str().c_str());
+              }
+            }
+            if (!hProcess && control.hRouteChanged.wait(1000)) {
+              startCapture = false;
+              break;
+            }
           }
-
+        } else {
+          // One-shot, by PID. The process can still exit between the control channel checking it
+          // and us opening it; then there is nothing to route until the source changes.
           hProcess.reset(OpenProcess(SYNCHRONIZE, false, pid));
           if (!hProcess) {
             std::wstringstream ss;
-            ss << L"AudioRouter: OpenProcess() failed for PID " << pid;
+            ss << L"AudioRouter: OpenProcess() failed for PID " << pid << L", waiting for a new source.";
             OutputDebugStringW(ss.str().c_str());
-            pid = 0;
-            continue;
+            control.hRouteChanged.wait();
+            startCapture = false;
           }
         }
+      }
 
+      bool processTerminated = false;
+      if (startCapture) {
         {
           std::wstringstream ss;
-          ss << L"AudioRouter: Attached to PID " << pid;
+          if (source.mode == RouteSource::Mode::ExcludeProcessTree) {
+            // A single exclude-mode stream carries every other process, so there is nothing to attach
+            // to or wait on; the route lives until the host process exits or the route is changed.
+            ss << L"AudioRouter: Capturing all processes except PID " << pid;
+          } else {
+            ss << L"AudioRouter: Attached to PID " << pid;
+          }
           OutputDebugStringW(ss.str().c_str());
         }
-        loopbackCapture.StartCaptureAsync(pid);
+        try {
+          loopbackCapture.StartCaptureAsync(pid, source.mode);
+          if (outputRequestQpc != 0) {
+            loopbackCapture.RecordOutputApplyLatency(outputRequestQpc);
+          }
+        } catch (const std::exception& ex) {
+          // Keep serving the control channel; the watchdog retries a capture stream that failed to
+          // activate, and a route change gets another go at the rest.
+          OutputDebugStringA(ex.what());
+          OutputDebugStringA("AudioRouter: Couldn't start the route.");
+        }
 
-        WaitForSingleObject(hProcess.get(), INFINITE);
-        OutputDebugStringW(L"AudioRouter: Attached process terminated.");
+        HANDLE waitHandles[] = { control.hRouteChanged.get(), hProcess.get() };
+        DWORD waitResult;
+        while (true) {
+          waitResult = WaitForMultipleObjects(hProcess ? 2 : 1, waitHandles, FALSE, CLoopbackCapture::kWatchdogIntervalMs);
+          if (waitResult == WAIT_TIMEOUT) {
+            loopbackCapture.CheckHealth();
+          } else if (waitResult != WAIT_OBJECT_0 || !RetuneRunningRoute(loopbackCapture, control)) {
+            break;
+          }
+        }
+        processTerminated = (waitResult == WAIT_OBJECT_0 + 1);
+        if (processTerminated) {
+          OutputDebugStringW(L"AudioRouter: Attached process terminated.");
+        }
 
-        loopbackCapture.StopCaptureAsync();
-        hProcess.reset();
-        pid = 0;
+        try {
+          loopbackCapture.StopCaptureAsync();
+        } catch (const std::exception& ex) {
+          OutputDebugStringA(ex.what());
+        }
       }
 
-    } else {
-      // One-shot, by PID
-      wil::unique_handle hProcess(OpenProcess(SYNCHRONIZE, false, pid));
-      THROW_LAST_ERROR_IF_NULL(hProcess);
-      loopbackCapture.StartCaptureAsync(pid);
-      WaitForSingleObject(hProcess.get(), INFINITE);
-      OutputDebugStringW(L"AudioRouter: Attached process terminated.");
-      loopbackCapture.StopCaptureAsync();
+      if (processTerminated && source.mode == RouteSource::Mode::IncludeProcessTree && !source.matchesByName())
+        break; // One-shot routes end with their source process.
+
+      RouteOutput output;
+      bool outputChanged;
+      {
+        auto lock = control.lock.lock();
+        source = control.source;
+        control.sourceChanged = false;
+        output = control.output;
+        outputChanged = control.outputChanged;
+        outputRequestQpc = outputChanged ? control.outputRequestQpc : 0;
+        control.outputChanged = false;
+      }
+      if (outputChanged) {
+        try {
+          loopbackCapture.SetOutput(output);
+        } catch (const std::exception& ex) {
+          OutputDebugStringA(ex.what());
+          OutputDebugStringA("AudioRouter: Couldn't open the requested output, falling back to the render device.");
+          output.streamDestination.clear();
+          try {
+            loopbackCapture.SetOutput(output);
+          } catch (const std::exception& fallbackEx) {
+            // No usable output; the route stays down until the next change.
+            OutputDebugStringA(fallbackEx.what());
+          }
+        }
+      }
     }
 
   } catch (const std::exception& ex) {
@@ -9,6 +9,10 @@
 #include <wil\com.h>
 #include <wil\result.h>
 
+#include "..\ControlChannel.h"
+#include "..\TraceReplay.h"
+#include "RtpReceiver.h"
+
 std::map<DWORD, std::wstring> pid_to_image;
 
 void UpdatePIDMap() {
@@ -67,20 +71,7 @@ DWORD FindPID(const wchar_t* wImageName) {
   return 0;
 }
 
-int wmain(int argc, wchar_t* argv[]) {
-
-  if (argc <= 2) {
-    printf("Usage: AudioRouterInjector target-imagename-or-pid source-imagename-or-pid\n");
-    printf("Routes audio from source to target.\n");
-    printf("If source is an imagename, routing will automatically be (re)attached when the process starts.\n");
-    printf("Image names are EXE filenames, like \"notepad.exe\"\n");
-    return -1;
-  }
-
-
-  wchar_t* targetSpecifier = argv[1];
-  wchar_t* sourceSpecifier = argv[2];
-
+DWORD ResolveTargetPID(const wchar_t* targetSpecifier) {
   DWORD pid = 0;
   {
     wchar_t* endptr = nullptr;
@@ -94,10 +85,150 @@ int wmain(int argc, wchar_t* argv[]) {
     pid = FindPID(targetSpecifier);
     if (pid <= 0) {
       printf("Couldn't find a running process matching \"%S\"\n", targetSpecifier);
+    }
+  }
+  return pid;
+}
+
+// Sends one command to the router running in the target process and prints its reply.
+int ControlMain(int argc, wchar_t* argv[]) {
+  DWORD pid = ResolveTargetPID(argv[2]);
+  if (pid <= 0)
+    return -1;
+
+  std::wstring command;
+  for (int argIdx = 3; argIdx < argc; ++argIdx) {
+    if (!command.empty())
+      command += L' ';
+    command += argv[argIdx];
+  }
+
+  std::wstring pipeName = CControlChannel::PipeNameForProcess(pid);
+  std::vector<wchar_t> reply(AUDIOROUTER_CONTROL_MESSAGE_MAX + 1, 0);
+  DWORD replyBytes = 0;
+
+  LARGE_INTEGER qpcFrequency, start, end;
+  QueryPerformanceFrequency(&qpcFrequency);
+  QueryPerformanceCounter(&start);
+  if (!CallNamedPipeW(pipeName.c_str(), (LPVOID) command.c_str(), (DWORD) ((command.size() + 1) * sizeof(wchar_t)),
+    reply.data(), (DWORD) (AUDIOROUTER_CONTROL_MESSAGE_MAX * sizeof(wchar_t)), &replyBytes, /*timeoutMs=*/ 2000)) {
+    printf("Couldn't reach the AudioRouter control channel for PID %d (error %u)\n", pid, GetLastError());
+    return -1;
+  }
+  QueryPerformanceCounter(&end);
+
+  printf("%S\n", reply.data());
+  printf("Round trip: %.3f ms\n", (double) (end.QuadPart - start.QuadPart) * 1000.0 / (double) qpcFrequency.QuadPart);
+  return 0;
+}
+
+// Replays a packet trace recorded with the "trace" control command and reports any glitches it
+// would cause. Returns nonzero if the render queue would overflow or underrun, so recorded field
+// incidents can be kept as regression checks.
+int ReplayTraceMain(const wchar_t* path) {
+  wil::unique_hfile file(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+  if (!file) {
+    printf("Couldn't open %S\n", path);
+    return -1;
+  }
+  // The result is a process exit code, not an HRESULT, so each failure is reported here.
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file.get(), &fileSize)) {
+    printf("Couldn't read %S (error %lu)\n", path, GetLastError());
+    return 1;
+  }
+  if (fileSize.QuadPart > MAXDWORD) {
+    printf("%S is too large to be a packet trace\n", path);
+    return 1;
+  }
+  std::vector<uint8_t> trace((size_t) fileSize.QuadPart);
+  DWORD bytesRead = 0;
+  if (!ReadFile(file.get(), trace.data(), (DWORD) trace.size(), &bytesRead, nullptr)) {
+    printf("Couldn't read %S (error %lu)\n", path, GetLastError());
+    return 1;
+  }
+
+  PacketTraceReader reader;
+  if (!reader.Open(trace.data(), bytesRead)) {
+    printf("%S is not a packet trace\n", path);
+    return -1;
+  }
+
+  PacketTraceReplayResult result;
+  ReplayPacketTrace(reader, result);
+
+  const PacketTraceFormat& format = reader.Format();
+  if (format.renderBufferFrames != 0) {
+    printf("Format: %u Hz, %u channels, capture buffer %u frames, render buffer %u frames%s\n",
+      format.sampleRate, format.channels, format.captureBufferFrames, format.renderBufferFrames, reader.IsTruncated() ? " (truncated)" : "");
+  } else {
+    printf("Format: %u Hz, %u channels, capture buffer %u frames, streamed to the network%s\n",
+      format.sampleRate, format.channels, format.captureBufferFrames, reader.IsTruncated() ? " (truncated)" : "");
+  }
+  printf("Wakeups: %llu, packets: %llu, frames: %llu\n", result.wakeups, result.packets, result.frames);
+  printf("Longest wakeup interval: %llu us, lowest render padding: %u frames\n", result.maxWakeupIntervalUs, result.minRenderPadding);
+  printf("Discontinuities: %llu, silent packets: %llu, device position gaps: %llu\n", result.discontinuities, result.silentPackets, result.devicePositionGaps);
+  if (format.renderBufferFrames != 0) {
+    printf("Render overflows: %llu, render underruns: %llu\n", result.renderOverflows, result.renderUnderruns);
+    printf("Wakeups where the simulated render padding differs from the recorded one: %llu\n", result.paddingMismatches);
+  } else {
+    printf("Frames streamed: %llu\n", result.streamedFrames);
+  }
+
+  return (result.renderOverflows != 0 || result.renderUnderruns != 0) ? 1 : 0;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+
+  if (argc >= 4 && !lstrcmpW(argv[1], L"--control")) {
+    return ControlMain(argc, argv);
+  }
+
+  if (argc >= 3 && !lstrcmpW(argv[1], L"--replay-trace")) {
+    return ReplayTraceMain(argv[2]);
+  }
+
+  if (argc >= 3 && !lstrcmpW(argv[1], L"--receive")) {
+    uint32_t port = wcstoul(argv[2], nullptr, 10);
+    uint32_t channels = (argc >= 4) ? wcstoul(argv[3], nullptr, 10) : 2;
+    uint32_t sampleRate = (argc >= 5) ? wcstoul(argv[4], nullptr, 10) : 48000;
+    uint32_t jitterMs = (argc >= 6) ? wcstoul(argv[5], nullptr, 10) : 20;
+    if (port == 0 || port > 65535 || channels == 0 || sampleRate == 0) {
+      printf("Invalid --receive arguments\n");
       return -1;
     }
+    try {
+      return RtpReceiverMain((uint16_t) port, channels, sampleRate, jitterMs);
+    } catch (const std::exception& ex) {
+      printf("%s\n", ex.what());
+      return -1;
+    }
+  }
+
+  if (argc <= 2) {
+    printf("Usage: AudioRouterInjector target-imagename-or-pid source-imagename-or-pid\n");
+    printf("       AudioRouterInjector --control target-imagename-or-pid command [arguments]\n");
+    printf("       AudioRouterInjector --receive port [channels] [sample-rate] [jitter-ms]\n");
+    printf("       AudioRouterInjector --replay-trace trace-file\n");
+    printf("Routes audio from source to target.\n");
+    printf("If source is an imagename, routing will automatically be (re)attached when the process starts.\n");
+    printf("If source is *, everything except the target process is routed.\n");
+    printf("Image names are EXE filenames, like \"notepad.exe\"\n");
+    printf("--control sends a command to a router that is already running in the target process:\n");
+    printf("  status, stats [reset], gain <dB>, qos <on|off>, source <pid|image|*>, device <name>, buffer <ms>, exclusive <on|off>, latency <interactive|relaxed>, stream <host:port|[address]:port|off>, trace <MB>|save <path>, replay <minutes>|save [seconds] <path>|off, fault <capture|render|stall>\n");
+    printf("--receive plays an RTP stream sent with the stream command on the default output device.\n");
+    printf("--replay-trace replays a packet trace saved with the trace command and reports glitches.\n");
+    return -1;
   }
 
+
+  wchar_t* targetSpecifier = argv[1];
+  wchar_t* sourceSpecifier = argv[2];
+
+  DWORD pid = ResolveTargetPID(targetSpecifier);
+  if (pid <= 0)
+    return -1;
+
   HANDLE hProcess = OpenProcess(PROCESS_ALL_ACCESS, FALSE, pid); // TODO verify process access requirements
   if (!hProcess) {
     printf("Couldn't open PID %d\n", pid);
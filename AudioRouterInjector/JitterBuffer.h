@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+//
+//  JitterBuffer
+//
+//  Reorders L16 RTP payloads by timestamp and releases them at a steady playout position once
+//  targetDepthFrames of audio are buffered. Late packets are dropped, gaps play as silence, and
+//  the playout position is pulled forward if sender and receiver clocks drift apart.
+//  Single-threaded: Insert() and Read() must be called from the same thread.
+//
+class JitterBuffer {
+public:
+  struct Stats {
+    uint64_t latePackets = 0;      // arrived after their audio was already played
+    uint64_t concealedFrames = 0;  // played as silence because nothing arrived for them
+    uint64_t underruns = 0;        // playout caught up with the newest data and had to rebuffer
+    uint64_t resyncs = 0;          // playout position jumped (stream restart or clock drift)
+  };
+
+  // capacityFrames must be a power of two and comfortably larger than targetDepthFrames.
+  JitterBuffer(uint32_t channels, uint32_t targetDepthFrames, uint32_t capacityFrames) :
+    m_channels(channels), m_targetDepthFrames(targetDepthFrames), m_capacityMask(capacityFrames - 1),
+    m_samples(capacityFrames * channels, 0), m_valid(capacityFrames, 0) {
+  }
+
+  void Insert(uint32_t timestamp, const uint8_t* l16Payload, uint32_t frameCount) {
+    if (!m_primed) {
+      Reset(timestamp);
+      m_primed = true;
+    }
+
+    int32_t endOffset = (int32_t) (timestamp + frameCount - m_playout);
+    if (endOffset <= 0) {
+      m_stats.latePackets++;
+      return;
+    }
+    if (endOffset > (int32_t) m_capacityMask) {
+      // Too far ahead to buffer: the sender restarted or we fell hopelessly behind.
+      m_stats.resyncs++;
+      Reset(timestamp);
+    }
+
+    int32_t startOffset = (int32_t) (timestamp - m_playout);
+    uint32_t firstFrame = (startOffset < 0) ? (uint32_t) -startOffset : 0; // drop the part that's already been played
+    for (uint32_t frame = firstFrame; frame < frameCount; ++frame) {
+      uint32_t slot = (timestamp + frame) & m_capacityMask;
+      const uint8_t* src = l16Payload + frame * m_channels * 2;
+      int16_t* dst = &m_samples[slot * m_channels];
+      for (uint32_t ch = 0; ch < m_channels; ++ch) {
+        dst[ch] = (int16_t) ((src[ch * 2] << 8) | src[ch * 2 + 1]);
+      }
+      m_valid[slot] = 1;
+    }
+
+    if ((int32_t) (timestamp + frameCount - m_writeEnd) > 0) {
+      m_writeEnd = timestamp + frameCount;
+    }
+  }
+
+  // Writes up to maxFrames of interleaved 16-bit samples to dst. Returns the number of frames
+  // written, which is 0 while (re)buffering.
+  uint32_t Read(int16_t* dst, uint32_t maxFrames) {
+    if (!m_primed)
+      return 0;
+
+    uint32_t depth = BufferedFrames();
+    if (!m_playing) {
+      if (depth < m_targetDepthFrames)
+        return 0;
+      m_playing = true;
+    }
+    if (depth == 0) {
+      m_stats.underruns++;
+      m_playing = false;
+      return 0;
+    }
+
+    // The sender's clock is running faster than ours; drop the excess so latency stays bounded.
+    if (depth > (m_targetDepthFrames * 2) + maxFrames) {
+      m_stats.resyncs++;
+      Discard(depth - m_targetDepthFrames);
+      depth = m_targetDepthFrames;
+    }
+
+    uint32_t frameCount = (depth < maxFrames) ? depth : maxFrames;
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+      uint32_t slot = (m_playout + frame) & m_capacityMask;
+      if (m_valid[slot]) {
+        memcpy(dst + frame * m_channels, &m_samples[slot * m_channels], m_channels * sizeof(int16_t));
+        m_valid[slot] = 0;
+      } else {
+        memset(dst + frame * m_channels, 0, m_channels * sizeof(int16_t));
+        m_stats.concealedFrames++;
+      }
+    }
+    m_playout += frameCount;
+    return frameCount;
+  }
+
+  uint32_t BufferedFrames() const { return m_primed ? (uint32_t) (m_writeEnd - m_playout) : 0; }
+  const Stats& GetStats() const { return m_stats; }
+
+private:
+  void Reset(uint32_t timestamp) {
+    memset(m_valid.data(), 0, m_valid.size());
+    m_playout = timestamp;
+    m_writeEnd = timestamp;
+    m_playing = false;
+  }
+
+  void Discard(uint32_t frameCount) {
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+      m_valid[(m_playout + frame) & m_capacityMask] = 0;
+    }
+    m_playout += frameCount;
+  }
+
+  uint32_t m_channels;
+  uint32_t m_targetDepthFrames;
+  uint32_t m_capacityMask;
+  std::vector<int16_t> m_samples;
+  std::vector<uint8_t> m_valid;
+
+  bool m_primed = false;
+  bool m_playing = false;
+  uint32_t m_playout = 0;  // timestamp of the next frame to play
+  uint32_t m_writeEnd = 0; // timestamp just past the newest frame received
+  Stats m_stats;
+};
@@ -0,0 +1,159 @@
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+#include <AudioClient.h>
+#include <mmdeviceapi.h>
+#include <stdio.h>
+#include <vector>
+
+#include <wil\com.h>
+#include <wil\resource.h>
+#include <wil\result.h>
+
+#include "RtpReceiver.h"
+#include "JitterBuffer.h"
+#include "..\Rtp.h"
+
+int RtpReceiverMain(uint16_t port, uint32_t channels, uint32_t sampleRate, uint32_t jitterMs) {
+  auto coInit = wil::CoInitializeEx(COINIT_MULTITHREADED);
+
+  WSADATA wsaData;
+  THROW_IF_WIN32_ERROR(WSAStartup(MAKEWORD(2, 2), &wsaData));
+  auto wsaCleanup = wil::scope_exit([]() { WSACleanup(); });
+
+  // Socket, bound on all interfaces. Readability is signalled through an event so a single thread
+  // can service both the network and the render device.
+  SOCKET sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+  THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), sock == INVALID_SOCKET);
+  auto closeSocket = wil::scope_exit([&]() { closesocket(sock); });
+
+  DWORD v6Only = 0; // accept IPv4 senders too
+  setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&v6Only), sizeof(v6Only));
+  int receiveBufferSize = 1024 * 1024;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&receiveBufferSize), sizeof(receiveBufferSize));
+
+  sockaddr_in6 bindAddress = {};
+  bindAddress.sin6_family = AF_INET6;
+  bindAddress.sin6_addr = in6addr_any;
+  bindAddress.sin6_port = htons(port);
+  THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), bind(sock, reinterpret_cast<const sockaddr*>(&bindAddress), sizeof(bindAddress)) == SOCKET_ERROR);
+
+  wil::unique_event socketReadable(wil::EventOptions::None);
+  THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), WSAEventSelect(sock, socketReadable.get(), FD_READ) == SOCKET_ERROR);
+
+  // Render client on the default device. The stream is L16, so ask the engine to convert from
+  // 16-bit PCM at the sender's rate into the device mix format.
+  wil::com_ptr<IMMDeviceEnumerator> enumerator = wil::CoCreateInstance<MMDeviceEnumerator, IMMDeviceEnumerator>(CLSCTX_ALL);
+  wil::com_ptr<IMMDevice> device;
+  THROW_IF_FAILED(enumerator->GetDefaultAudioEndpoint(eRender, eConsole, device.put()));
+  wil::com_ptr<IAudioClient> audioClient;
+  THROW_IF_FAILED(device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, audioClient.put_void()));
+
+  WAVEFORMATEX format = {};
+  format.wFormatTag = WAVE_FORMAT_PCM;
+  format.nChannels = (WORD) channels;
+  format.nSamplesPerSec = sampleRate;
+  format.wBitsPerSample = 16;
+  format.nBlockAlign = (WORD) (channels * sizeof(int16_t));
+  format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+
+  THROW_IF_FAILED(audioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
+    AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+    /*bufferDuration (100ns)=*/ 200000,
+    /*periodicity (100ns)=*/ 0,
+    &format,
+    /*audioSessionGuid=*/ nullptr));
+
+  wil::unique_event renderReady(wil::EventOptions::None);
+  THROW_IF_FAILED(audioClient->SetEventHandle(renderReady.get()));
+  UINT32 renderBufferFrames = 0;
+  THROW_IF_FAILED(audioClient->GetBufferSize(&renderBufferFrames));
+  wil::com_ptr<IAudioRenderClient> renderClient;
+  THROW_IF_FAILED(audioClient->GetService(__uuidof(IAudioRenderClient), renderClient.put_void()));
+  THROW_IF_FAILED(audioClient->Start());
+
+  // Two seconds of history is plenty for any jitter depth we'd want on a LAN.
+  uint32_t capacityFrames = 1;
+  while (capacityFrames < sampleRate * 2)
+    capacityFrames <<= 1;
+  JitterBuffer jitterBuffer(channels, (sampleRate * jitterMs) / 1000, capacityFrames);
+
+  printf("Receiving L16/%u/%u on UDP port %u, jitter buffer %u ms\n", sampleRate, channels, port, jitterMs);
+
+  std::vector<uint8_t> datagram(65536);
+  bool haveSequence = false;
+  uint16_t expectedSequence = 0;
+  uint64_t packetsReceived = 0, bytesReceived = 0, packetsLost = 0, packetsOutOfOrder = 0;
+
+  LARGE_INTEGER qpcFrequency, lastReport;
+  QueryPerformanceFrequency(&qpcFrequency);
+  QueryPerformanceCounter(&lastReport);
+  uint64_t lastBytesReceived = 0;
+
+  HANDLE waitHandles[] = { socketReadable.get(), renderReady.get() };
+  while (true) {
+    DWORD waitResult = WaitForMultipleObjects(2, waitHandles, FALSE, 1000);
+
+    if (waitResult == WAIT_OBJECT_0) {
+      // Drain every datagram that's queued; FD_READ is re-armed by each recv().
+      while (true) {
+        int received = recv(sock, reinterpret_cast<char*>(datagram.data()), (int) datagram.size(), 0);
+        if (received == SOCKET_ERROR)
+          break;
+
+        RtpHeader header;
+        size_t payloadOffset = 0, payloadSize = 0;
+        if (!ParseRtpHeader(datagram.data(), received, header, payloadOffset, payloadSize) || header.payloadType != RTP_PAYLOAD_TYPE_L16)
+          continue;
+
+        packetsReceived++;
+        bytesReceived += received;
+
+        if (haveSequence && header.sequence != expectedSequence) {
+          uint16_t gap = (uint16_t) (header.sequence - expectedSequence);
+          if (gap < 0x8000) {
+            packetsLost += gap;
+          } else {
+            packetsOutOfOrder++;
+            if (packetsLost > 0)
+              packetsLost--; // it was counted as lost when we skipped past it
+          }
+        }
+        if (!haveSequence || (uint16_t) (header.sequence - expectedSequence) < 0x8000) {
+          expectedSequence = header.sequence + 1;
+          haveSequence = true;
+        }
+
+        jitterBuffer.Insert(header.timestamp, datagram.data() + payloadOffset, (uint32_t) (payloadSize / (channels * sizeof(int16_t))));
+      }
+    }
+
+    // Top up the render buffer from the jitter buffer whenever there's room.
+    UINT32 padding = 0;
+    THROW_IF_FAILED(audioClient->GetCurrentPadding(&padding));
+    UINT32 framesFree = renderBufferFrames - padding;
+    if (framesFree > 0) {
+      BYTE* renderBuffer = nullptr;
+      THROW_IF_FAILED(renderClient->GetBuffer(framesFree, &renderBuffer));
+      UINT32 framesWritten = jitterBuffer.Read(reinterpret_cast<int16_t*>(renderBuffer), framesFree);
+      THROW_IF_FAILED(renderClient->ReleaseBuffer(framesWritten, 0));
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if (now.QuadPart - lastReport.QuadPart >= qpcFrequency.QuadPart) {
+      double seconds = (double) (now.QuadPart - lastReport.QuadPart) / (double) qpcFrequency.QuadPart;
+      const JitterBuffer::Stats& stats = jitterBuffer.GetStats();
+      printf("%.1f kbit/s, %llu packets, %llu lost, %llu reordered, %llu late, %llu frames concealed, %llu underruns, %llu resyncs, added latency %.1f ms (jitter buffer %.1f ms + device queue %.1f ms)\n",
+        (double) (bytesReceived - lastBytesReceived) * 8.0 / 1000.0 / seconds,
+        packetsReceived, packetsLost, packetsOutOfOrder, stats.latePackets, stats.concealedFrames, stats.underruns, stats.resyncs,
+        (double) (jitterBuffer.BufferedFrames() + padding) * 1000.0 / sampleRate,
+        (double) jitterBuffer.BufferedFrames() * 1000.0 / sampleRate,
+        (double) padding * 1000.0 / sampleRate);
+      lastReport = now;
+      lastBytesReceived = bytesReceived;
+    }
+  }
+
+  return 0;
+}
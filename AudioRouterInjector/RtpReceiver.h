@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Receives an RTP/L16 stream from an AudioRouter network sink and plays it on the default render
+// device through a jitter buffer. Runs until the process is terminated.
+int RtpReceiverMain(uint16_t port, uint32_t channels, uint32_t sampleRate, uint32_t jitterMs);
@@ -0,0 +1,105 @@
+#include "ControlChannel.h"
+
+#include <sstream>
+#include <vector>
+#include <wctype.h>
+
+#include <wil\result.h>
+
+std::wstring CControlChannel::PipeNameForProcess(DWORD processId) {
+  std::wstringstream ss;
+  ss << AUDIOROUTER_CONTROL_PIPE_PREFIX << processId;
+  return ss.str();
+}
+
+CControlChannel::CControlChannel(DWORD hostProcessId, CommandHandler handler) : m_pipeName(PipeNameForProcess(hostProcessId)), m_handler(handler) {
+  THROW_IF_FAILED(m_hStop.create(wil::EventOptions::ManualReset));
+  THROW_IF_FAILED(m_hIoCompleted.create(wil::EventOptions::ManualReset));
+
+  m_thread = std::thread([this]() { ServeThread(); });
+}
+
+CControlChannel::~CControlChannel() {
+  m_hStop.SetEvent();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+//
+//  WaitForIo()
+//
+//  Waits for a pending overlapped operation on the pipe. Returns false if the channel is shutting
+//  down or the operation failed.
+//
+bool CControlChannel::WaitForIo(HANDLE pipe, OVERLAPPED& overlapped, DWORD& bytesTransferred) {
+  HANDLE waitHandles[] = { m_hStop.get(), overlapped.hEvent };
+  if (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+    CancelIoEx(pipe, &overlapped);
+    GetOverlappedResult(pipe, &overlapped, &bytesTransferred, TRUE);
+    return false;
+  }
+  return GetOverlappedResult(pipe, &overlapped, &bytesTransferred, FALSE) != FALSE;
+}
+
+void CControlChannel::ServeThread() {
+  std::vector<wchar_t> request(AUDIOROUTER_CONTROL_MESSAGE_MAX);
+
+  while (!m_hStop.is_signaled()) {
+    wil::unique_hfile pipe(CreateNamedPipeW(m_pipeName.c_str(),
+      PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+      PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+      /*maxInstances=*/ 1,
+      /*outBufferSize=*/ AUDIOROUTER_CONTROL_MESSAGE_MAX * sizeof(wchar_t),
+      /*inBufferSize=*/ AUDIOROUTER_CONTROL_MESSAGE_MAX * sizeof(wchar_t),
+      /*defaultTimeout=*/ 0,
+      /*securityAttributes=*/ nullptr));
+    if (!pipe) {
+      OutputDebugStringA("AudioRouter: CreateNamedPipe() failed, control channel disabled.");
+      return;
+    }
+
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = m_hIoCompleted.get();
+    DWORD bytesTransferred = 0;
+
+    m_hIoCompleted.ResetEvent();
+    if (!ConnectNamedPipe(pipe.get(), &overlapped)) {
+      DWORD err = GetLastError();
+      if (err == ERROR_IO_PENDING) {
+        if (!WaitForIo(pipe.get(), overlapped, bytesTransferred))
+          continue;
+      } else if (err != ERROR_PIPE_CONNECTED) {
+        continue;
+      }
+    }
+
+    m_hIoCompleted.ResetEvent();
+    if (!ReadFile(pipe.get(), request.data(), (DWORD) (request.size() * sizeof(wchar_t)), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+      continue;
+    if (!WaitForIo(pipe.get(), overlapped, bytesTransferred))
+      continue;
+
+    std::wstring command(request.data(), bytesTransferred / sizeof(wchar_t));
+    while (!command.empty() && (command.back() == L'\0' || iswspace(command.back())))
+      command.pop_back();
+
+    std::wstring reply;
+    try {
+      reply = m_handler(command);
+    } catch (const std::exception& ex) {
+      OutputDebugStringA(ex.what());
+      reply = L"error: command failed";
+    }
+    if (reply.size() >= AUDIOROUTER_CONTROL_MESSAGE_MAX)
+      reply.resize(AUDIOROUTER_CONTROL_MESSAGE_MAX - 1);
+
+    m_hIoCompleted.ResetEvent();
+    if (!WriteFile(pipe.get(), reply.c_str(), (DWORD) ((reply.size() + 1) * sizeof(wchar_t)), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+      continue;
+    if (!WaitForIo(pipe.get(), overlapped, bytesTransferred))
+      continue;
+
+    FlushFileBuffers(pipe.get());
+    DisconnectNamedPipe(pipe.get());
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Windows.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <wil\resource.h>
+
+// Each router serves its control pipe as AUDIOROUTER_CONTROL_PIPE_PREFIX + host PID.
+#define AUDIOROUTER_CONTROL_PIPE_PREFIX L"\\\\.\\pipe\\AudioRouter."
+
+// Size limit (in WCHARs) for a single control request or reply message.
+#define AUDIOROUTER_CONTROL_MESSAGE_MAX 4096
+
+//
+//  CControlChannel
+//
+//  Serves one-line text commands over a local named pipe on its own thread, so commands never run
+//  on the audio thread. Each connection carries a single request message and a single reply message;
+//  the handler is invoked on the channel thread and its return value is sent back as the reply.
+//
+class CControlChannel {
+public:
+  typedef std::function<std::wstring(const std::wstring& command)> CommandHandler;
+
+  CControlChannel(DWORD hostProcessId, CommandHandler handler);
+  ~CControlChannel();
+
+  static std::wstring PipeNameForProcess(DWORD processId);
+
+private:
+  void ServeThread();
+  bool WaitForIo(HANDLE pipe, OVERLAPPED& overlapped, DWORD& bytesTransferred);
+
+  std::wstring m_pipeName;
+  CommandHandler m_handler;
+
+  wil::unique_event_nothrow m_hStop;
+  wil::unique_event_nothrow m_hIoCompleted;
+  std::thread m_thread;
+};
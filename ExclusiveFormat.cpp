@@ -0,0 +1,145 @@
+#include "ExclusiveFormat.h"
+
+#include <math.h>
+#include <string.h>
+
+uint16_t ContainerBytesPerSample(PcmSampleType sampleType) {
+  switch (sampleType) {
+    case PcmSampleType::Int24:
+      return 3;
+    case PcmSampleType::Int16:
+      return 2;
+    case PcmSampleType::Float32:
+    case PcmSampleType::Int32:
+    case PcmSampleType::Int24In32:
+    default:
+      return 4;
+  }
+}
+
+uint16_t ValidBitsPerSample(PcmSampleType sampleType) {
+  switch (sampleType) {
+    case PcmSampleType::Int24:
+    case PcmSampleType::Int24In32:
+      return 24;
+    case PcmSampleType::Int16:
+      return 16;
+    case PcmSampleType::Float32:
+    case PcmSampleType::Int32:
+    default:
+      return 32;
+  }
+}
+
+std::vector<PcmFormat> ExclusiveFormatCandidates(uint32_t mixSampleRate, uint16_t mixChannels) {
+  static const PcmSampleType sampleTypes[] = { PcmSampleType::Float32, PcmSampleType::Int32, PcmSampleType::Int24In32, PcmSampleType::Int24, PcmSampleType::Int16 };
+  static const uint32_t fallbackRates[] = { 48000, 44100, 96000 };
+
+  std::vector<uint32_t> rates(1, mixSampleRate);
+  for (uint32_t rate : fallbackRates) {
+    if (rate != mixSampleRate)
+      rates.push_back(rate);
+  }
+  std::vector<uint16_t> channelCounts(1, mixChannels);
+  if (mixChannels != 2)
+    channelCounts.push_back(2);
+
+  std::vector<PcmFormat> candidates;
+  for (uint16_t channels : channelCounts) {
+    for (uint32_t rate : rates) {
+      for (PcmSampleType sampleType : sampleTypes) {
+        PcmFormat candidate;
+        candidate.sampleRate = rate;
+        candidate.channels = channels;
+        candidate.sampleType = sampleType;
+        candidates.push_back(candidate);
+      }
+    }
+  }
+  return candidates;
+}
+
+bool NegotiateExclusiveFormat(uint32_t mixSampleRate, uint16_t mixChannels,
+  const std::function<bool(const PcmFormat&)>& isFormatSupported, PcmFormat& negotiated) {
+  for (const PcmFormat& candidate : ExclusiveFormatCandidates(mixSampleRate, mixChannels)) {
+    if (isFormatSupported(candidate)) {
+      negotiated = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ConvertFloatToPcm(const float* src, uint8_t* dst, size_t sampleCount, PcmSampleType sampleType) {
+  if (sampleType == PcmSampleType::Float32) {
+    memcpy(dst, src, sampleCount * sizeof(float));
+    return;
+  }
+
+  for (size_t i = 0; i < sampleCount; ++i) {
+    float sample = src[i];
+    sample = (sample > 1.0f) ? 1.0f : ((sample < -1.0f) ? -1.0f : sample);
+
+    // Round to nearest: truncating would pull every sample toward zero, an offset of opposite sign on
+    // either side of it. +1.0 rounds one step past the largest positive value, hence the clamp.
+    switch (sampleType) {
+      case PcmSampleType::Int32:
+      case PcmSampleType::Int24In32: {
+        // Scale in double so full scale doesn't overflow; the low byte is simply ignored by 24-bit devices.
+        long long rounded = llrint((double) sample * 2147483648.0);
+        int32_t value = (rounded > INT32_MAX) ? INT32_MAX : (int32_t) rounded;
+        memcpy(dst + i * 4, &value, 4);
+        break;
+      }
+      case PcmSampleType::Int24: {
+        long rounded = lrintf(sample * 8388608.0f);
+        int32_t value = (rounded > 8388607) ? 8388607 : (int32_t) rounded;
+        dst[i * 3] = (uint8_t) value;
+        dst[i * 3 + 1] = (uint8_t) (value >> 8);
+        dst[i * 3 + 2] = (uint8_t) (value >> 16);
+        break;
+      }
+      case PcmSampleType::Int16:
+      default: {
+        long rounded = lrintf(sample * 32768.0f);
+        int16_t value = (rounded > INT16_MAX) ? INT16_MAX : (int16_t) rounded;
+        memcpy(dst + i * 2, &value, 2);
+        break;
+      }
+    }
+  }
+}
+
+void ConvertFloatToPcmDithered(const float* src, uint8_t* dst, size_t sampleCount, PcmSampleType sampleType, uint32_t& ditherState) {
+  float lsb;
+  if (sampleType == PcmSampleType::Int16) {
+    lsb = 1.0f / 32768.0f;
+  } else if (sampleType == PcmSampleType::Int24) {
+    lsb = 1.0f / 8388608.0f;
+  } else {
+    // Float and 32-bit containers have resolution to spare.
+    ConvertFloatToPcm(src, dst, sampleCount, sampleType);
+    return;
+  }
+
+  // Dither a stack-sized chunk at a time, then convert it as usual.
+  float dithered[256];
+  uint16_t bytesPerSample = ContainerBytesPerSample(sampleType);
+  uint32_t state = ditherState;
+  while (sampleCount > 0) {
+    size_t chunk = (sampleCount < 256) ? sampleCount : 256;
+    for (size_t i = 0; i < chunk; ++i) {
+      // Difference of two uniform variables in [0, 1) LSB: triangular noise in (-1, 1) LSB.
+      state = state * 1664525u + 1013904223u;
+      float r1 = (float) (state >> 8) * (1.0f / 16777216.0f);
+      state = state * 1664525u + 1013904223u;
+      float r2 = (float) (state >> 8) * (1.0f / 16777216.0f);
+      dithered[i] = src[i] + (r1 - r2) * lsb;
+    }
+    ConvertFloatToPcm(dithered, dst, chunk, sampleType);
+    src += chunk;
+    dst += chunk * bytesPerSample;
+    sampleCount -= chunk;
+  }
+  ditherState = state;
+}
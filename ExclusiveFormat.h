@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Format negotiation and sample conversion for exclusive-mode output. In exclusive mode the device
+// takes only formats it natively supports, so we probe a ranked list of candidates and convert our
+// float capture into whichever one it accepts. Kept free of WASAPI types so the negotiation and
+// fallback logic can be driven by a fake device.
+
+enum class PcmSampleType {
+  Float32,
+  Int32,
+  Int24In32, // 24 valid bits, left-justified in a 32-bit container
+  Int24,     // packed 3-byte samples
+  Int16,
+};
+
+struct PcmFormat {
+  uint32_t sampleRate = 0;
+  uint16_t channels = 0;
+  PcmSampleType sampleType = PcmSampleType::Float32;
+};
+
+uint16_t ContainerBytesPerSample(PcmSampleType sampleType);
+uint16_t ValidBitsPerSample(PcmSampleType sampleType);
+
+// Candidates to try for an exclusive-mode stream, best first: the mix format's rate and channel
+// count in every sample type, then common rates, then stereo.
+std::vector<PcmFormat> ExclusiveFormatCandidates(uint32_t mixSampleRate, uint16_t mixChannels);
+
+// Returns the first candidate the device accepts. Returns false if there is none, in which case
+// the caller falls back to shared mode.
+bool NegotiateExclusiveFormat(uint32_t mixSampleRate, uint16_t mixChannels,
+  const std::function<bool(const PcmFormat&)>& isFormatSupported, PcmFormat& negotiated);
+
+// Converts interleaved float samples in [-1, 1] to the given sample type, rounding to the nearest
+// step, with clipping.
+void ConvertFloatToPcm(const float* src, uint8_t* dst, size_t sampleCount, PcmSampleType sampleType);
+
+// Same, but adds TPDF dither before rounding to 16 or 24 bits, so quiet passages decay into
+// noise instead of distortion. ditherState carries the noise generator between calls.
+void ConvertFloatToPcmDithered(const float* src, uint8_t* dst, size_t sampleCount, PcmSampleType sampleType, uint32_t& ditherState);
@@ -0,0 +1,142 @@
+#include "LocalControlSocket.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wctype.h>
+#include <vector>
+
+// Size limit (in wchar_t) for a single request or reply, as for the named pipe.
+static const size_t kMessageMax = 4096;
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL; // A client that hangs up early must not kill the host.
+#else
+static const int kSendFlags = 0;
+#endif
+
+static bool MakeAddress(const std::string& path, sockaddr_un& address) {
+  memset(&address, 0, sizeof(address));
+  if (path.empty() || path.size() >= sizeof(address.sun_path))
+    return false;
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+// A message is the raw wchar_t string, ended by the sender shutting down its side of the socket.
+static std::wstring ReadMessage(int socket) {
+  std::vector<wchar_t> message(kMessageMax);
+  char* data = reinterpret_cast<char*>(message.data());
+  size_t capacity = message.size() * sizeof(wchar_t);
+  size_t received = 0;
+  while (received < capacity) {
+    ssize_t count = recv(socket, data + received, capacity - received, 0);
+    if (count <= 0)
+      break;
+    received += (size_t) count;
+  }
+  return std::wstring(message.data(), received / sizeof(wchar_t));
+}
+
+static bool WriteMessage(int socket, const std::wstring& message) {
+  const char* data = reinterpret_cast<const char*>(message.c_str());
+  size_t remaining = message.size() * sizeof(wchar_t);
+  while (remaining > 0) {
+    ssize_t count = send(socket, data, remaining, kSendFlags);
+    if (count <= 0)
+      return false;
+    data += count;
+    remaining -= (size_t) count;
+  }
+  return shutdown(socket, SHUT_WR) == 0;
+}
+
+LocalControlSocket::LocalControlSocket(const std::string& path, CommandHandler handler) : m_path(path), m_handler(handler) {
+  sockaddr_un address;
+  if (!MakeAddress(m_path, address))
+    return;
+
+  m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (m_listenSocket < 0)
+    return;
+  unlink(m_path.c_str());
+  if (bind(m_listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(m_listenSocket, 4) != 0 || pipe(m_stopPipe) != 0) {
+    close(m_listenSocket);
+    m_listenSocket = -1;
+    return;
+  }
+
+  m_thread = std::thread([this]() { ServeThread(); });
+}
+
+LocalControlSocket::~LocalControlSocket() {
+  if (m_thread.joinable()) {
+    char stop = 0;
+    while (write(m_stopPipe[1], &stop, 1) < 0 && errno == EINTR) {
+    }
+    m_thread.join();
+  }
+  for (int fd : m_stopPipe) {
+    if (fd >= 0)
+      close(fd);
+  }
+  if (m_listenSocket >= 0) {
+    close(m_listenSocket);
+    unlink(m_path.c_str());
+  }
+}
+
+void LocalControlSocket::ServeThread() {
+  while (true) {
+    pollfd waitFds[2] = { { m_stopPipe[0], POLLIN, 0 }, { m_listenSocket, POLLIN, 0 } };
+    if (poll(waitFds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (waitFds[0].revents != 0)
+      return;
+    if ((waitFds[1].revents & POLLIN) == 0)
+      continue;
+
+    int connection = accept(m_listenSocket, nullptr, nullptr);
+    if (connection < 0)
+      continue;
+
+    std::wstring command = ReadMessage(connection);
+    while (!command.empty() && (command.back() == L'\0' || iswspace(command.back())))
+      command.pop_back();
+
+    std::wstring reply;
+    try {
+      reply = m_handler(command);
+    } catch (const std::exception&) {
+      reply = L"error: command failed";
+    }
+    if (reply.size() >= kMessageMax)
+      reply.resize(kMessageMax - 1);
+
+    WriteMessage(connection, reply);
+    close(connection);
+  }
+}
+
+bool LocalControlSocket::SendCommand(const std::string& path, const std::wstring& command, std::wstring& reply) {
+  sockaddr_un address;
+  if (!MakeAddress(path, address))
+    return false;
+
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0)
+    return false;
+  bool sent = connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+    WriteMessage(connection, command.substr(0, kMessageMax - 1));
+  if (sent)
+    reply = ReadMessage(connection);
+  close(connection);
+  return sent;
+}
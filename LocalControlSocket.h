@@ -0,0 +1,38 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+//
+//  LocalControlSocket
+//
+//  Portable stand-in for CControlChannel, so control paths can be exercised without Windows. It has
+//  the same protocol and handler contract: each connection carries one request message and one
+//  reply message, and the handler runs on the channel's own thread, never the audio thread. It is
+//  served over a Unix-domain socket instead of a named pipe. POSIX only.
+//
+class LocalControlSocket {
+public:
+  typedef std::function<std::wstring(const std::wstring& command)> CommandHandler;
+
+  // Starts serving at `path`, replacing any stale socket file left there. IsServing() reports
+  // whether that worked.
+  LocalControlSocket(const std::string& path, CommandHandler handler);
+  ~LocalControlSocket();
+
+  bool IsServing() const { return m_thread.joinable(); }
+
+  // Client side: sends one command and waits for the reply. Returns false if nothing is serving
+  // at `path` or the connection failed.
+  static bool SendCommand(const std::string& path, const std::wstring& command, std::wstring& reply);
+
+private:
+  void ServeThread();
+
+  std::string m_path;
+  CommandHandler m_handler;
+  int m_listenSocket = -1;
+  int m_stopPipe[2] = { -1, -1 }; // Written to by the destructor to wake ServeThread()
+  std::thread m_thread;
+};
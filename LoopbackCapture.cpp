@@ -1,13 +1,94 @@
+#include <WinSock2.h>
 #include <shlobj.h>
 #include <wchar.h>
 #include <audioclientactivationparams.h>
 #include <Functiondiscoverykeys_devpkey.h>
 #include <cassert>
+#include <math.h>
+#include <sstream>
+#include <mmreg.h>
+#include <ksmedia.h>
 
 #include "LoopbackCapture.h"
+#include "AllocationCounter.h"
+#include "NetworkSink.h"
 
 #define BITS_PER_BYTE 8
 
+static bool IsFloat32Format(const WAVEFORMATEX* format) {
+  if (format->wBitsPerSample != 32)
+    return false;
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    return true;
+  if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    return IsEqualGUID(reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(format)->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) != FALSE;
+  return false;
+}
+
+// Current QPC in 100ns units, the same clock and units as GetBuffer's QPC position.
+static UINT64 QpcNow100ns() {
+  static const LONGLONG qpcFrequency = []() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+  }();
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (UINT64) ((now.QuadPart / qpcFrequency) * 10000000 + ((now.QuadPart % qpcFrequency) * 10000000) / qpcFrequency);
+}
+
+// CPU cycles the calling thread has run, so time spent preempted doesn't count against the route.
+static uint64_t ThreadCycleCount() {
+  ULONG64 cycles = 0;
+  QueryThreadCycleTime(GetCurrentThread(), &cycles);
+  return cycles;
+}
+
+static_assert(PACKET_TRACE_FLAG_DATA_DISCONTINUITY == AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY &&
+  PACKET_TRACE_FLAG_SILENT == AUDCLNT_BUFFERFLAGS_SILENT && PACKET_TRACE_FLAG_TIMESTAMP_ERROR == AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR,
+  "capture flags are passed through to the pipeline and the packet trace unchanged");
+
+//
+//  WasapiRenderTarget
+//
+//  The route's render client, as the pipeline's render queue. A full queue is reported as Full;
+//  any other failure means the device has gone away.
+//
+class WasapiRenderTarget : public RenderTarget {
+public:
+  explicit WasapiRenderTarget(IAudioRenderClient* renderClient) : m_renderClient(renderClient) {}
+
+  RenderStatus GetBuffer(uint32_t frames, uint8_t** buffer) override {
+    HRESULT hr = m_renderClient->GetBuffer(frames, buffer);
+    if (SUCCEEDED(hr))
+      return RenderStatus::Ok;
+    return (hr == AUDCLNT_E_BUFFER_TOO_LARGE) ? RenderStatus::Full : RenderStatus::Failed;
+  }
+
+  void ReleaseBuffer(uint32_t frames, bool silent) override {
+    m_renderClient->ReleaseBuffer(frames, silent ? AUDCLNT_BUFFERFLAGS_SILENT : 0);
+  }
+
+private:
+  IAudioRenderClient* m_renderClient;
+};
+
+static WAVEFORMATEXTENSIBLE ToWaveFormat(const PcmFormat& pcmFormat, DWORD channelMask) {
+  WAVEFORMATEXTENSIBLE format = {};
+  format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format.Format.nChannels = pcmFormat.channels;
+  format.Format.nSamplesPerSec = pcmFormat.sampleRate;
+  format.Format.wBitsPerSample = ContainerBytesPerSample(pcmFormat.sampleType) * 8;
+  format.Format.nBlockAlign = pcmFormat.channels * ContainerBytesPerSample(pcmFormat.sampleType);
+  format.Format.nAvgBytesPerSec = format.Format.nSamplesPerSec * format.Format.nBlockAlign;
+  format.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+  format.Samples.wValidBitsPerSample = ValidBitsPerSample(pcmFormat.sampleType);
+  format.dwChannelMask = channelMask ? channelMask : (pcmFormat.channels == 1 ? KSAUDIO_SPEAKER_MONO : (pcmFormat.channels == 2 ? KSAUDIO_SPEAKER_STEREO : 0));
+  format.SubFormat = (pcmFormat.sampleType == PcmSampleType::Float32) ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+  return format;
+}
+
 HRESULT CLoopbackCapture::SetDeviceStateErrorIfFailed(HRESULT hr) {
   if (FAILED(hr)) {
     m_DeviceState = DeviceState::Error;
@@ -15,9 +96,12 @@ HRESULT CLoopbackCapture::SetDeviceStateErrorIfFailed(HRESULT hr) {
   return hr;
 }
 
-CLoopbackCapture::CLoopbackCapture() {
+CLoopbackCapture::CLoopbackCapture() : m_pipeline(m_stats, ThreadCycleCount), m_watchdog(m_stats, QpcNow100ns) {
   // Create events for sample ready or user stop
   THROW_IF_FAILED(m_SampleReadyEvent.create(wil::EventOptions::None));
+  m_relaxedWakeupTimer.reset(CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS));
+  THROW_LAST_ERROR_IF(!m_relaxedWakeupTimer);
+  m_statsSince = QpcNow100ns();
 
   // Initialize MF
   THROW_IF_FAILED(MFStartup(MF_VERSION, MFSTARTUP_LITE));
@@ -35,10 +119,22 @@ CLoopbackCapture::CLoopbackCapture() {
   // Create the capture-stopped event as auto-reset
   THROW_IF_FAILED(m_hCaptureStopped.create(wil::EventOptions::None));
 
-  SelectAudioDevice();
+  // Create the capture-started event as manual-reset, so a late waiter still sees it
+  THROW_IF_FAILED(m_hCaptureStarted.create(wil::EventOptions::ManualReset));
+
+  RenderSide side;
+  OpenRenderSide(m_output, side);
+  SwapRenderSide(side);
 }
 
-void CLoopbackCapture::SelectAudioDevice() {
+//
+//  OpenRenderSide()
+//
+//  Finds and opens the output device `output` asks for, along with the capture format that has to
+//  feed it. Touches nothing the running route uses, so it can be called without the lock while the
+//  audio thread carries on.
+//
+void CLoopbackCapture::OpenRenderSide(const RouteOutput& output, RenderSide& side) {
   wil::com_ptr<IMMDeviceEnumerator> enumerator = wil::CoCreateInstance<MMDeviceEnumerator, IMMDeviceEnumerator>(CLSCTX_ALL);
 
 
@@ -52,7 +148,8 @@ void CLoopbackCapture::SelectAudioDevice() {
   THROW_IF_FAILED(enumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, deviceCollection.put()));
   UINT deviceCount;
 
-  m_audioOutputDevice.reset(); // clear any previous device selection
+  wil::com_ptr<IMMDevice> firstNonDefaultDevice;
+  std::wstring firstNonDefaultDeviceName;
 
   THROW_IF_FAILED(deviceCollection->GetCount(&deviceCount));
   for (UINT deviceIdx = 0; deviceIdx < deviceCount; ++deviceIdx) {
@@ -73,32 +170,468 @@ void CLoopbackCapture::SelectAudioDevice() {
     snprintf(buf, 512, "AudioRouter: Endpoint %u: \"%S\" (%S)", deviceIdx, deviceFriendlyName.pwszVal, deviceIdStr.get());
     OutputDebugStringA(buf);
 
-    if (m_audioOutputDevice == nullptr) {
+    if (side.device == nullptr && !output.deviceName.empty() && lstrcmpiW(deviceFriendlyName.pwszVal, output.deviceName.c_str()) == 0) {
+      OutputDebugStringA("  - Using this endpoint, since it matches the requested device name.");
+      side.device = device;
+      side.deviceName = deviceFriendlyName.pwszVal;
+    }
+
+    if (firstNonDefaultDevice == nullptr) {
       if (lstrcmpW(deviceFriendlyName.pwszVal, L"Speakers (NVIDIA Broadcast)") == 0) {
         OutputDebugStringA("  - Skipping NVIDIA Broadcast device.");
         continue;
       }
       if (lstrcmpW(deviceIdStr.get(), defaultAudioEndpointIdStr.get()) != 0) {
-        OutputDebugStringA("  - Using this endpoint, since it's the first non-default render device available.");
-        m_audioOutputDevice = device;
+        OutputDebugStringA("  - This is the first non-default render device available.");
+        firstNonDefaultDevice = device;
+        firstNonDefaultDeviceName = deviceFriendlyName.pwszVal;
       }
     }
   }
 
-  if (!m_audioOutputDevice) {
+  if (!side.device) {
+    if (!output.deviceName.empty()) {
+      OutputDebugStringA("Requested output device not found, falling back to the first non-default render device.");
+    }
+    side.device = firstNonDefaultDevice;
+    side.deviceName = firstNonDefaultDeviceName;
+  }
+
+  if (!side.device) {
     OutputDebugStringA("Only one audio output device and it's the default one.");
-    m_audioOutputDevice = defaultAudioEndpoint;
+    side.device = defaultAudioEndpoint;
+    side.deviceName = L"(default endpoint)";
+  }
+
+  THROW_IF_FAILED(side.device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, side.client.put_void()));
+  THROW_IF_FAILED(side.client->GetMixFormat(side.captureFormat.put()));
+
+  side.exclusive = false;
+  if (output.exclusive) {
+    HRESULT hr = InitializeExclusiveOutput(output, side);
+    if (SUCCEEDED(hr)) {
+      side.exclusive = true;
+    } else {
+      char buf[128];
+      snprintf(buf, 128, "AudioRouter: Exclusive mode unavailable (0x%08x), falling back to shared mode.", hr);
+      OutputDebugStringA(buf);
+      // A failed Initialize leaves the client unusable, so start over with a fresh one.
+      THROW_IF_FAILED(side.device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, side.client.put_void()));
+    }
+  }
+
+  if (!side.exclusive) {
+    THROW_IF_FAILED(side.client->Initialize(AUDCLNT_SHAREMODE_SHARED, /*streamFlags=*/ 0,
+      /*bufferDuration (100ns)=*/ (REFERENCE_TIME) RenderBufferMs(output) * 10000,
+      /*periodicity (ns)=*/ 0,
+      side.captureFormat.get(),
+      /*audioSessionGuid=*/ nullptr));
+    side.format.sampleRate = side.captureFormat.get()->nSamplesPerSec;
+    side.format.channels = side.captureFormat.get()->nChannels;
+    side.format.sampleType = PcmSampleType::Float32;
+    side.blockAlign = side.captureFormat.get()->nBlockAlign;
+  }
+  THROW_IF_FAILED(side.client->GetBufferSize(&side.bufferFrames));
+  THROW_IF_FAILED(side.client->GetService(__uuidof(IAudioRenderClient), side.renderClient.put_void()));
+
+  side.captureIsFloat = IsFloat32Format(side.captureFormat.get());
+}
+
+// Relaxed routes need room in the render queue for the pre-roll plus a whole batch.
+UINT32 CLoopbackCapture::RenderBufferMs(const RouteOutput& output) {
+  if (output.latency == LatencyClass::Relaxed) {
+    UINT32 minimumMs = kRelaxedRenderBufferMs;
+    return max(output.renderBufferMs, minimumMs);
+  }
+  return output.renderBufferMs;
+}
+
+//
+//  InitializeExclusiveOutput()
+//
+//  Negotiates a format the output device supports natively and opens it in exclusive mode at its
+//  minimum period. On success, side.captureFormat is replaced with a float capture format at the
+//  negotiated rate and channel count, so the loopback stream does any resampling for us and only
+//  the sample type is left to convert.
+//
+HRESULT CLoopbackCapture::InitializeExclusiveOutput(const RouteOutput& output, RenderSide& side) {
+  const WAVEFORMATEX* mixFormat = side.captureFormat.get();
+  DWORD channelMask = (mixFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(mixFormat)->dwChannelMask : 0;
+
+  PcmFormat negotiated;
+  bool found = NegotiateExclusiveFormat(mixFormat->nSamplesPerSec, mixFormat->nChannels, [&](const PcmFormat& candidate) {
+    WAVEFORMATEXTENSIBLE format = ToWaveFormat(candidate, (candidate.channels == mixFormat->nChannels) ? channelMask : 0);
+    return side.client->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE, &format.Format, nullptr) == S_OK;
+  }, negotiated);
+  RETURN_HR_IF(AUDCLNT_E_UNSUPPORTED_FORMAT, !found);
+
+  WAVEFORMATEXTENSIBLE renderFormat = ToWaveFormat(negotiated, (negotiated.channels == mixFormat->nChannels) ? channelMask : 0);
+
+  REFERENCE_TIME minimumPeriod = 0;
+  RETURN_IF_FAILED(side.client->GetDevicePeriod(nullptr, &minimumPeriod));
+  REFERENCE_TIME bufferDuration = max((REFERENCE_TIME) RenderBufferMs(output) * 10000, minimumPeriod * 2);
+
+  // We push from the capture callback rather than waiting on a render event, so the buffer can be
+  // longer than the period.
+  HRESULT hr = side.client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE, /*streamFlags=*/ 0,
+    bufferDuration, minimumPeriod, &renderFormat.Format, /*audioSessionGuid=*/ nullptr);
+  if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+    // Round up to a buffer size the device can do and retry on a fresh client.
+    UINT32 alignedFrames = 0;
+    RETURN_IF_FAILED(side.client->GetBufferSize(&alignedFrames));
+    bufferDuration = (REFERENCE_TIME) ((10000000.0 * alignedFrames / renderFormat.Format.nSamplesPerSec) + 0.5);
+    RETURN_IF_FAILED(side.device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, side.client.put_void()));
+    hr = side.client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE, /*streamFlags=*/ 0,
+      bufferDuration, minimumPeriod, &renderFormat.Format, /*audioSessionGuid=*/ nullptr);
+  }
+  RETURN_IF_FAILED(hr);
+
+  PcmFormat captureFormat = negotiated;
+  captureFormat.sampleType = PcmSampleType::Float32;
+  WAVEFORMATEXTENSIBLE* captureWaveFormat = static_cast<WAVEFORMATEXTENSIBLE*>(CoTaskMemAlloc(sizeof(WAVEFORMATEXTENSIBLE)));
+  RETURN_IF_NULL_ALLOC(captureWaveFormat);
+  *captureWaveFormat = ToWaveFormat(captureFormat, renderFormat.dwChannelMask);
+  side.captureFormat.reset(&captureWaveFormat->Format);
+
+  side.format = negotiated;
+  side.blockAlign = renderFormat.Format.nBlockAlign;
+
+  char buf[160];
+  snprintf(buf, 160, "AudioRouter: Exclusive mode, %u Hz, %u channels, %u-bit %s, period %lld00 ns.",
+    negotiated.sampleRate, negotiated.channels, ValidBitsPerSample(negotiated.sampleType),
+    negotiated.sampleType == PcmSampleType::Float32 ? "float" : "PCM", minimumPeriod);
+  OutputDebugStringA(buf);
+  return S_OK;
+}
+
+//
+//  SwapRenderSide()
+//
+//  Exchanges `side` with the route's current output. Only the router thread changes the render
+//  side, so it may read these members without the lock, but anyone else must hold m_CritSec.
+//
+void CLoopbackCapture::SwapRenderSide(RenderSide& side) {
+  m_audioOutputDevice.swap(side.device);
+  m_audioClientForOutput.swap(side.client);
+  m_audioRenderClient.swap(side.renderClient);
+  m_waveFormat.swap(side.captureFormat);
+  m_outputDeviceName.swap(side.deviceName);
+  std::swap(m_outputIsFloat, side.captureIsFloat);
+  std::swap(m_outputExclusive, side.exclusive);
+  std::swap(m_renderFormat, side.format);
+  std::swap(m_renderBlockAlign, side.blockAlign);
+  std::swap(m_renderBufferSizeFrames, side.bufferFrames);
+}
+
+//
+//  InstallRenderSide()
+//
+//  Swaps a newly opened render side in under a running route, between two callbacks, and starts
+//  it. The old client is stopped and released once the lock is dropped, since the audio thread no
+//  longer uses it by then.
+//
+HRESULT CLoopbackCapture::InstallRenderSide(RenderSide& side) {
+  HRESULT hr = S_OK;
+  {
+    auto lock = m_CritSec.lock();
+    SwapRenderSide(side);
+    if (!m_networkSink) {
+      hr = StartRender();
+    }
+  }
+  if (side.client) {
+    side.client->Stop();
+  }
+  side = RenderSide();
+  return hr;
+}
+
+//
+//  ReleaseExclusiveOutput()
+//
+//  An exclusive-mode client keeps anyone else, including a replacement for itself, from opening its
+//  device, so it has to be closed before a new render side is opened. The rest of the render side
+//  (in particular the capture format) stays in place. Only used while the audio thread is not
+//  rendering: capture is stopped, or the render side is flagged as failed.
+//
+void CLoopbackCapture::ReleaseExclusiveOutput() {
+  if (!m_outputExclusive)
+    return;
+  auto lock = m_CritSec.lock();
+  m_audioRenderClient.reset();
+  m_audioClientForOutput.reset();
+}
+
+// Whether a render side opened since capture started can be fed by the running capture stream.
+bool CLoopbackCapture::CaptureFormatMatches(const RenderSide& side) const {
+  const WAVEFORMATEX* current = m_waveFormat.get();
+  const WAVEFORMATEX* wanted = side.captureFormat.get();
+  return wanted->nSamplesPerSec == current->nSamplesPerSec && wanted->nChannels == current->nChannels &&
+    side.captureIsFloat == m_outputIsFloat;
+}
+
+//
+//  AllocateRouteBuffers()
+//
+//  Sizes the route arena from the capture and render buffers. A single capture packet never exceeds
+//  m_BufferFrames, and we never write more than m_renderBufferSizeFrames at once.
+//
+HRESULT CLoopbackCapture::AllocateRouteBuffers() {
+  UINT32 channels = m_waveFormat.get()->nChannels;
+  m_processBufferFrames = max(m_BufferFrames, m_renderBufferSizeFrames);
+
+  RETURN_HR_IF(E_OUTOFMEMORY, !m_arena.Reset(RouteArena::AlignedSize(m_processBufferFrames * channels * sizeof(float))));
+  m_processBuffer = m_arena.Allocate<float>(m_processBufferFrames * channels);
+  return S_OK;
+}
+
+void CLoopbackCapture::SetOutput(const RouteOutput& output) {
+  THROW_HR_IF(E_NOT_VALID_STATE, (m_DeviceState == DeviceState::Starting) ||
+               (m_DeviceState == DeviceState::Capturing) ||
+               (m_DeviceState == DeviceState::Stopping));
+
+  // Open everything before replacing anything, so a device or destination that fails leaves the
+  // previous output in place, unless the previous output holds its device exclusively.
+  ReleaseExclusiveOutput();
+  RenderSide side;
+  OpenRenderSide(output, side);
+  std::shared_ptr<CNetworkSink> networkSink;
+  if (!output.streamDestination.empty()) {
+    networkSink = std::make_shared<CNetworkSink>();
+    THROW_IF_FAILED(networkSink->Open(output.streamDestination, side.captureFormat.get()));
+  }
+
+  auto lock = m_CritSec.lock();
+  m_output = output;
+  SwapRenderSide(side);
+  m_networkSink.swap(networkSink);
+}
+
+//
+//  RetuneOutput()
+//
+//  Moves a running route to a different output device or render buffer length without stopping
+//  capture: the new device is opened alongside the old one and swapped in between two callbacks,
+//  so the stream only loses whatever was still queued on the old device. Changes that alter the
+//  capture stream itself (a different mix format, exclusive mode, the latency class or the network
+//  destination) return S_FALSE without touching anything, and need a restart through SetOutput().
+//  Router thread only.
+//
+HRESULT CLoopbackCapture::RetuneOutput(const RouteOutput& output) {
+  if (m_DeviceState != DeviceState::Capturing || output.exclusive || m_outputExclusive ||
+      output.latency != m_output.latency || output.streamDestination != m_output.streamDestination) {
+    return S_FALSE;
+  }
+
+  RenderSide side;
+  try {
+    OpenRenderSide(output, side);
+  } catch (const std::exception& ex) {
+    OutputDebugStringA(ex.what());
+    return wil::ResultFromCaughtException();
   }
+  if (!CaptureFormatMatches(side)) {
+    return S_FALSE;
+  }
+
+  RETURN_IF_FAILED(InstallRenderSide(side));
+  {
+    auto lock = m_CritSec.lock();
+    m_output = output;
+  }
+  // Whatever was wrong with the old device, the new one is working.
+  m_watchdog.ClearRenderFault();
+  return S_OK;
+}
+
+void CLoopbackCapture::RecordOutputApplyLatency(LONGLONG requestQpc) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  m_outputApplyLatency.store(now.QuadPart - requestQpc, std::memory_order_relaxed);
+}
+
+void CLoopbackCapture::SetGainDb(float gainDb) {
+  auto lock = m_paramsLock.lock();
+  m_params.gain = powf(10.0f, gainDb / 20.0f);
+  PublishParams();
+}
 
-  THROW_IF_FAILED(m_audioOutputDevice->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, m_audioClientForOutput.put_void()));
-  THROW_IF_FAILED(m_audioClientForOutput->GetMixFormat(m_waveFormat.put()));
-  THROW_IF_FAILED(m_audioClientForOutput->Initialize(AUDCLNT_SHAREMODE_SHARED, /*streamFlags=*/ 0,
-    /*bufferDuration (ns)=*/ 1000000,
-    /*periodicity (ns)=*/ 0,
-    m_waveFormat.get(),
-    /*audioSessionGuid=*/ nullptr));
-  THROW_IF_FAILED(m_audioClientForOutput->GetBufferSize(&m_renderBufferSizeFrames));
-  THROW_IF_FAILED(m_audioClientForOutput->GetService(__uuidof(IAudioRenderClient), m_audioRenderClient.put_void()));
+void CLoopbackCapture::SetQosEnabled(bool enabled) {
+  auto lock = m_paramsLock.lock();
+  m_params.qosEnabled = enabled;
+  PublishParams();
+}
+
+//
+//  PublishParams()
+//
+//  Hands m_params to the audio thread. Caller must hold m_paramsLock, which keeps
+//  m_paramsHandoff single-producer.
+//
+void CLoopbackCapture::PublishParams() {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  m_params.publishQpc = now.QuadPart;
+
+  m_paramsHandoff.Back() = m_params;
+  m_paramsHandoff.Publish();
+}
+
+void CLoopbackCapture::StartPacketTrace(size_t capacityBytes) {
+  // The router thread can swap the render side (and with it the format) under the lock.
+  PacketTraceFormat format;
+  {
+    auto lock = m_CritSec.lock();
+    format.sampleRate = m_waveFormat.get()->nSamplesPerSec;
+    format.channels = m_waveFormat.get()->nChannels;
+    format.captureBufferFrames = m_BufferFrames;
+    // A streamed route has no render queue to account for.
+    format.renderBufferFrames = m_networkSink ? 0 : m_renderBufferSizeFrames;
+  }
+
+  // Allocate outside the lock; the audio thread only ever sees a fully constructed recorder.
+  std::unique_ptr<PacketTraceWriter> packetTrace(new PacketTraceWriter(capacityBytes, format));
+  auto lock = m_CritSec.lock();
+  m_packetTrace.swap(packetTrace);
+}
+
+HRESULT CLoopbackCapture::SavePacketTrace(const std::wstring& path) {
+  std::unique_ptr<PacketTraceWriter> packetTrace;
+  {
+    auto lock = m_CritSec.lock();
+    m_packetTrace.swap(packetTrace);
+  }
+  RETURN_HR_IF(E_NOT_VALID_STATE, !packetTrace);
+
+  std::vector<uint8_t> serialized;
+  packetTrace->Serialize(serialized);
+
+  wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+  RETURN_LAST_ERROR_IF(!file);
+  DWORD bytesWritten = 0;
+  RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), serialized.data(), (DWORD) serialized.size(), &bytesWritten, nullptr));
+  return S_OK;
+}
+
+HRESULT CLoopbackCapture::StartReplayBuffer(uint32_t seconds) {
+  uint32_t sampleRate;
+  uint32_t channels;
+  {
+    // The history is kept as 16-bit ADPCM encoded straight from the float mix format.
+    auto lock = m_CritSec.lock();
+    RETURN_HR_IF(E_NOT_VALID_STATE, !m_waveFormat || !m_outputIsFloat);
+    sampleRate = m_waveFormat.get()->nSamplesPerSec;
+    channels = m_waveFormat.get()->nChannels;
+  }
+
+  // Allocate outside the lock; a 30-minute history is tens of MB. If the format changes before the
+  // swap, the audio thread sees the mismatch and leaves the history alone.
+  std::shared_ptr<ReplayBuffer> replayBuffer = std::make_shared<ReplayBuffer>(sampleRate, channels, seconds);
+  auto lock = m_CritSec.lock();
+  m_replayBuffer.swap(replayBuffer);
+  return S_OK;
+}
+
+void CLoopbackCapture::StopReplayBuffer() {
+  std::shared_ptr<ReplayBuffer> replayBuffer;
+  auto lock = m_CritSec.lock();
+  m_replayBuffer.swap(replayBuffer);
+}
+
+HRESULT CLoopbackCapture::SaveReplay(const std::wstring& path, uint32_t seconds) {
+  std::shared_ptr<ReplayBuffer> replayBuffer;
+  {
+    auto lock = m_CritSec.lock();
+    replayBuffer = m_replayBuffer;
+  }
+  RETURN_HR_IF(E_NOT_VALID_STATE, !replayBuffer);
+
+  std::vector<uint8_t> wavFile;
+  RETURN_HR_IF(E_NOT_VALID_STATE, !replayBuffer->Snapshot(seconds, wavFile));
+
+  wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+  RETURN_LAST_ERROR_IF(!file);
+  DWORD bytesWritten = 0;
+  RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), wavFile.data(), (DWORD) wavFile.size(), &bytesWritten, nullptr));
+  return S_OK;
+}
+
+std::wstring CLoopbackCapture::GetStats() const {
+  UINT64 elapsed = QpcNow100ns() - m_statsSince.load(std::memory_order_relaxed);
+  uint64_t callbacks = m_stats.callbacks.load(std::memory_order_relaxed);
+  uint64_t cycles = m_stats.totalCallbackCycles.load(std::memory_order_relaxed);
+
+  std::wstringstream ss;
+  ss << m_stats.Format()
+     << L" wakeupsPerSecond=" << (elapsed ? callbacks * 10000000 / elapsed : 0)
+     << L" cyclesPerSecond=" << (elapsed ? (uint64_t) (cycles * 10000000.0 / elapsed) : 0);
+  return ss.str();
+}
+
+void CLoopbackCapture::ResetStats() {
+  m_stats.Reset();
+  m_statsSince = QpcNow100ns();
+}
+
+std::wstring CLoopbackCapture::GetStatus() {
+  static const wchar_t* const stateNames[] = { L"Uninitialized", L"Error", L"Initialized", L"Starting", L"Capturing", L"Stopping", L"Stopped" };
+
+  LARGE_INTEGER qpcFrequency;
+  QueryPerformanceFrequency(&qpcFrequency);
+
+  float gain;
+  bool qosEnabled;
+  {
+    auto lock = m_paramsLock.lock();
+    gain = m_params.gain;
+    qosEnabled = m_params.qosEnabled;
+  }
+
+  // Reading the meter starts a new peak-hold window.
+  float peak = m_pipeline.TakePeak();
+
+  // The router thread swaps the render side and reinitializes capture under m_CritSec.
+  std::wstring deviceName;
+  UINT32 renderBufferFrames;
+  bool exclusive;
+  bool relaxed;
+  // Holding a reference keeps the sink alive if SetOutput() replaces it while we format its status.
+  std::shared_ptr<CNetworkSink> networkSink;
+  {
+    auto lock = m_CritSec.lock();
+    networkSink = m_networkSink;
+    deviceName = m_outputDeviceName;
+    renderBufferFrames = m_renderBufferSizeFrames;
+    exclusive = m_outputExclusive;
+    relaxed = m_relaxed;
+  }
+
+  std::wstringstream ss;
+  ss << L"state=" << stateNames[static_cast<int>(m_DeviceState)]
+     << L" device=\"" << deviceName << L"\""
+     << L" renderBufferFrames=" << renderBufferFrames
+     << L" shareMode=" << (exclusive ? L"exclusive" : L"shared")
+     << L" latency=" << (relaxed ? L"relaxed" : L"interactive")
+     << L" gainDb=" << (20.0f * log10f(gain))
+     << L" peakDb=" << (peak > 0.0f ? 20.0f * log10f(peak) : -INFINITY)
+     << L" qos=" << (qosEnabled ? L"on" : L"off")
+     << L" paramsApplyLatencyUs=" << (m_paramsApplyLatency.load(std::memory_order_relaxed) * 1000000 / qpcFrequency.QuadPart)
+     << L" outputApplyLatencyUs=" << (m_outputApplyLatency.load(std::memory_order_relaxed) * 1000000 / qpcFrequency.QuadPart);
+  if (networkSink) {
+    ss << L" " << networkSink->GetStatus();
+  }
+  {
+    auto lock = m_CritSec.lock();
+    if (m_packetTrace) {
+      ss << L" traceBytes=" << m_packetTrace->EventBytes() << (m_packetTrace->IsTruncated() ? L" traceTruncated" : L"");
+    }
+    if (m_replayBuffer) {
+      ss << L" replaySeconds=" << m_replayBuffer->SecondsHeld()
+         << L" replayMemoryBytes=" << m_replayBuffer->MemoryBytes()
+         << L" replayBytesPerMinute=" << m_replayBuffer->BytesPerMinute();
+    }
+  }
+  return ss.str();
 }
 
 CLoopbackCapture::~CLoopbackCapture() {
@@ -107,10 +640,20 @@ CLoopbackCapture::~CLoopbackCapture() {
   }
 }
 
-void CLoopbackCapture::ActivateAudioInterface(DWORD processId) {
+static PROCESS_LOOPBACK_MODE ProcessLoopbackModeFor(RouteSource::Mode mode) {
+  switch (mode) {
+    case RouteSource::Mode::ExcludeProcessTree:
+      return PROCESS_LOOPBACK_MODE_EXCLUDE_TARGET_PROCESS_TREE;
+    case RouteSource::Mode::IncludeProcessTree:
+    default:
+      return PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE;
+  }
+}
+
+void CLoopbackCapture::ActivateAudioInterface(DWORD processId, RouteSource::Mode mode) {
   AUDIOCLIENT_ACTIVATION_PARAMS audioclientActivationParams = {};
   audioclientActivationParams.ActivationType = AUDIOCLIENT_ACTIVATION_TYPE_PROCESS_LOOPBACK;
-  audioclientActivationParams.ProcessLoopbackParams.ProcessLoopbackMode = PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE;
+  audioclientActivationParams.ProcessLoopbackParams.ProcessLoopbackMode = ProcessLoopbackModeFor(mode);
   audioclientActivationParams.ProcessLoopbackParams.TargetProcessId = processId;
 
   PROPVARIANT activateParams = {};
@@ -156,9 +699,20 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
 #endif
 
   // Initialize the AudioClient in Shared Mode with the user specified buffer
+  // AUTOCONVERTPCM lets the capture format differ from the engine's, which exclusive-mode output relies on.
+  // Relaxed routes poll on their own timer, so they skip the event and buffer a whole batch.
+  {
+    // GetStatus() reads the latency class from the control thread.
+    auto lock = m_CritSec.lock();
+    m_relaxed = (m_output.latency == LatencyClass::Relaxed);
+  }
+  DWORD streamFlags = AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+  if (!m_relaxed) {
+    streamFlags |= AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
+  }
   RETURN_IF_FAILED(m_AudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
-                                             AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
-                                             200000,
+                                             streamFlags,
+                                             m_relaxed ? (REFERENCE_TIME) kRelaxedCaptureBufferMs * 10000 : 200000,
                                              AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM,
                                              m_waveFormat.get(),
                                              nullptr));
@@ -166,6 +720,16 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
   // Get the maximum size of the AudioClient Buffer
   RETURN_IF_FAILED(m_AudioClient->GetBufferSize(&m_BufferFrames));
 
+  // The engine period is how long each wakeup has before the next one is due. A relaxed route's
+  // pre-roll lets a batch run a full wakeup late.
+  RETURN_IF_FAILED(m_AudioClient->GetDevicePeriod(&m_devicePeriod, nullptr));
+  m_wakeupPeriod = m_relaxed ? (REFERENCE_TIME) kRelaxedWakeupMs * 10000 : m_devicePeriod;
+  m_deadline = m_relaxed ? (REFERENCE_TIME) (kRelaxedWakeupMs + kRelaxedPreRollMs) * 10000 : m_devicePeriod;
+  m_watchdog.SetWakeupPeriod(m_wakeupPeriod, m_relaxed ? (UINT64) kRelaxedWakeupToleranceMs * 10000 : 0);
+
+  // Size every intermediate buffer now, so streaming never allocates
+  RETURN_IF_FAILED(AllocateRouteBuffers());
+
   // Get the capture client
   RETURN_IF_FAILED(m_AudioClient->GetService(IID_PPV_ARGS(&m_AudioCaptureClient)));
 
@@ -173,7 +737,9 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
   RETURN_IF_FAILED(MFCreateAsyncResult(nullptr, &m_xSampleReady, nullptr, &m_SampleReadyAsyncResult));
 
   // Tell the system which event handle it should signal when an audio buffer is ready to be processed by the client
-  RETURN_IF_FAILED(m_AudioClient->SetEventHandle(m_SampleReadyEvent.get()));
+  if (!m_relaxed) {
+    RETURN_IF_FAILED(m_AudioClient->SetEventHandle(m_SampleReadyEvent.get()));
+  }
 
   // Everything is ready.
   m_DeviceState = DeviceState::Initialized;
@@ -187,13 +753,20 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
 }
 
 
-void CLoopbackCapture::StartCaptureAsync(DWORD processId) {
-  ActivateAudioInterface(processId);
+void CLoopbackCapture::StartCaptureAsync(DWORD processId, RouteSource::Mode mode) {
+  // A failed SetOutput() can leave the route without an output device.
+  THROW_HR_IF(E_NOT_VALID_STATE, !m_audioClientForOutput);
+
+  // Kept so the watchdog can reactivate the same capture.
+  m_processId = processId;
+  m_processMode = mode;
+  ActivateAudioInterface(processId, mode);
 
   // We should be in the initialzied state if this is the first time through getting ready to capture.
   if (m_DeviceState == DeviceState::Initialized) {
     m_DeviceState = DeviceState::Starting;
-    THROW_IF_FAILED(MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_xStartCapture, nullptr));
+    m_hCaptureStarted.ResetEvent();
+    THROW_IF_FAILED(SetDeviceStateErrorIfFailed(MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_xStartCapture, nullptr)));
   }
 }
 
@@ -203,28 +776,71 @@ void CLoopbackCapture::StartCaptureAsync(DWORD processId) {
 //  Callback method to start capture
 //
 HRESULT CLoopbackCapture::OnStartCapture(IMFAsyncResult* pResult) {
+  // Lets StopCaptureAsync() wait out a start that is still in flight.
+  auto signalStarted = wil::scope_exit([&]() { m_hCaptureStarted.SetEvent(); });
+
   return SetDeviceStateErrorIfFailed([&]()->HRESULT {
     // Start the capture
     RETURN_IF_FAILED(m_AudioClient->Start());
 
-    RETURN_IF_FAILED(m_audioClientForOutput->Start());
+    // A render device that won't start is left to the watchdog, like one that fails later on.
+    m_watchdog.ClearRenderFault();
+    if (!m_networkSink && FAILED(StartRender())) {
+      m_watchdog.NoteRenderFault();
+    }
+
+    if (m_relaxed) {
+      LARGE_INTEGER dueTime;
+      dueTime.QuadPart = -(LONGLONG) kRelaxedWakeupMs * 10000;
+      RETURN_IF_WIN32_BOOL_FALSE(SetWaitableTimerEx(m_relaxedWakeupTimer.get(), &dueTime, kRelaxedWakeupMs, nullptr, nullptr, nullptr, kRelaxedWakeupToleranceMs));
+    }
 
+    m_watchdog.NoteWakeup();
     m_DeviceState = DeviceState::Capturing;
-    MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
+    MFPutWaitingWorkItem(SampleReadyHandle(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
 
     return S_OK;
    }());
 }
 
+//
+//  StartRender()
+//
+//  Starts the render client. Relaxed routes first queue a batch's worth of silence, so the render
+//  queue doesn't run dry between coarse wakeups.
+//
+HRESULT CLoopbackCapture::StartRender() {
+  if (m_relaxed) {
+    UINT32 padding = 0;
+    RETURN_IF_FAILED(m_audioClientForOutput->GetCurrentPadding(&padding));
+    UINT32 preRollFrames = min(m_renderFormat.sampleRate * kRelaxedPreRollMs / 1000, m_renderBufferSizeFrames - padding);
+    if (preRollFrames > 0) {
+      BYTE* outputBuffer = nullptr;
+      RETURN_IF_FAILED(m_audioRenderClient->GetBuffer(preRollFrames, &outputBuffer));
+      RETURN_IF_FAILED(m_audioRenderClient->ReleaseBuffer(preRollFrames, AUDCLNT_BUFFERFLAGS_SILENT));
+    }
+  }
+  return m_audioClientForOutput->Start();
+}
+
+HANDLE CLoopbackCapture::SampleReadyHandle() const {
+  return m_relaxed ? m_relaxedWakeupTimer.get() : m_SampleReadyEvent.get();
+}
+
 
 //
 //  StopCaptureAsync()
 //
-//  Stop capture asynchronously via MF Work Item
+//  Stop capture asynchronously via MF Work Item. Waits for a start that is still in flight, and
+//  does nothing if capture never got going.
 //
 void CLoopbackCapture::StopCaptureAsync() {
-  THROW_HR_IF(E_NOT_VALID_STATE, (m_DeviceState != DeviceState::Capturing) &&
-               (m_DeviceState != DeviceState::Error));
+  if (m_DeviceState == DeviceState::Starting) {
+    m_hCaptureStarted.wait();
+  }
+  if ((m_DeviceState != DeviceState::Capturing) && (m_DeviceState != DeviceState::Error)) {
+    return;
+  }
 
   m_DeviceState = DeviceState::Stopping;
 
@@ -233,7 +849,10 @@ void CLoopbackCapture::StopCaptureAsync() {
   // Wait for capture to stop
   m_hCaptureStopped.wait();
 
-  m_audioClientForOutput->Stop();
+  // The watchdog may have closed the render client and failed to reopen it.
+  if (m_audioClientForOutput) {
+    m_audioClientForOutput->Stop();
+  }
 }
 
 //
@@ -249,7 +868,14 @@ HRESULT CLoopbackCapture::OnStopCapture(IMFAsyncResult* pResult) {
     m_SampleReadyKey = 0;
   }
 
-  m_AudioClient->Stop();
+  if (m_relaxed) {
+    CancelWaitableTimer(m_relaxedWakeupTimer.get());
+  }
+
+  // The watchdog may have torn the capture client down and failed to rebuild it.
+  if (m_AudioClient) {
+    m_AudioClient->Stop();
+  }
   m_SampleReadyAsyncResult.reset();
 
   return FinishCaptureAsync();
@@ -282,6 +908,164 @@ HRESULT CLoopbackCapture::OnFinishCapture(IMFAsyncResult* pResult) {
   return S_OK;
 }
 
+//
+//  CheckHealth()
+//
+//  Watchdog, run on the router thread. RouteWatchdog decides what has failed and orders the
+//  rebuilds through the WatchdogBackend methods below; this only logs what it did.
+//
+void CLoopbackCapture::CheckHealth() {
+  WatchdogCheck check = m_watchdog.Check(*this);
+  if (!check.captureFailed && !check.renderFailed)
+    return;
+
+  char buf[160];
+  if (check.recovered) {
+    snprintf(buf, 160, "AudioRouter: Watchdog rebuilt %s side in %llu ms (%llu ms since the failure).",
+      check.captureFailed ? (check.renderFailed ? "capture and render" : "capture") : "render", check.rebuildMs, check.outageMs);
+  } else {
+    snprintf(buf, 160, "AudioRouter: Watchdog couldn't rebuild the %s side (0x%08x), retrying in 500 ms.",
+      check.captureFailed ? "capture" : "render", m_lastRebuildResult);
+  }
+  OutputDebugStringA(buf);
+}
+
+bool CLoopbackCapture::CaptureFailed() {
+  return m_DeviceState == DeviceState::Error;
+}
+
+// A capture stream that hasn't woken up is stalled if the engine still has data queued for it.
+bool CLoopbackCapture::CaptureHasQueuedData() {
+  if (m_DeviceState != DeviceState::Capturing || !m_AudioClient)
+    return false;
+  UINT32 padding = 0;
+  HRESULT hr = m_AudioClient->GetCurrentPadding(&padding);
+  return FAILED(hr) || padding > 0;
+}
+
+RebuildStatus CLoopbackCapture::RebuildRender() {
+  m_lastRebuildResult = RecoverRender(m_pendingRender);
+  if (FAILED(m_lastRebuildResult)) {
+    m_pendingRender = RenderSide();
+    return RebuildStatus::Failed;
+  }
+  // S_FALSE: the new device wants a different format, so capture has to follow.
+  return (m_lastRebuildResult == S_FALSE) ? RebuildStatus::FormatChanged : RebuildStatus::Ok;
+}
+
+bool CLoopbackCapture::RebuildCapture() {
+  m_lastRebuildResult = RecoverCapture(m_pendingRender.client ? &m_pendingRender : nullptr);
+  return SUCCEEDED(m_lastRebuildResult);
+}
+
+//
+//  RecoverCapture()
+//
+//  Drops the loopback client and activates a new one for the same process, leaving the render
+//  side (or network sink) running. If `newRender` is given, it is installed while capture is down
+//  and the new capture stream is opened in its format.
+//
+HRESULT CLoopbackCapture::RecoverCapture(RenderSide* newRender) {
+  {
+    // Taking the lock waits out a callback in flight; Stopping keeps it from requeueing.
+    auto lock = m_CritSec.lock();
+    m_DeviceState = DeviceState::Stopping;
+    if (0 != m_SampleReadyKey) {
+      MFCancelWorkItem(m_SampleReadyKey);
+      m_SampleReadyKey = 0;
+    }
+    if (m_AudioClient) {
+      m_AudioClient->Stop();
+    }
+    m_SampleReadyAsyncResult.reset();
+    m_AudioCaptureClient.reset();
+    m_AudioClient.reset();
+    if (newRender) {
+      SwapRenderSide(*newRender);
+    }
+  }
+  if (newRender) {
+    if (newRender->client) {
+      newRender->client->Stop();
+    }
+    *newRender = RenderSide();
+  }
+
+  try {
+    ActivateAudioInterface(m_processId, m_processMode);
+  } catch (const std::exception& ex) {
+    OutputDebugStringA(ex.what());
+    m_DeviceState = DeviceState::Error;
+    return wil::ResultFromCaughtException();
+  }
+
+  auto lock = m_CritSec.lock();
+  HRESULT hr = m_AudioClient->Start();
+  if (SUCCEEDED(hr) && newRender && !m_networkSink) {
+    hr = StartRender();
+  }
+  if (FAILED(hr)) {
+    m_DeviceState = DeviceState::Error;
+    return hr;
+  }
+  m_watchdog.NoteWakeup();
+  m_DeviceState = DeviceState::Capturing;
+  return MFPutWaitingWorkItem(SampleReadyHandle(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
+}
+
+//
+//  RecoverRender()
+//
+//  Reopens the output device while capture keeps running. The device is opened without the lock,
+//  so the audio thread carries on (dropping render output) while that takes however long it takes,
+//  and then swapped in. Returns S_FALSE if the rebuilt device has a different mix format; it is
+//  left in `side`, and the render side stays flagged, until capture has been rebuilt to match.
+//
+HRESULT CLoopbackCapture::RecoverRender(RenderSide& side) {
+  ReleaseExclusiveOutput();
+  try {
+    OpenRenderSide(m_output, side);
+  } catch (const std::exception& ex) {
+    OutputDebugStringA(ex.what());
+    return wil::ResultFromCaughtException();
+  }
+
+  if (!CaptureFormatMatches(side)) {
+    return S_FALSE;
+  }
+
+  RETURN_IF_FAILED(InstallRenderSide(side));
+  m_watchdog.ClearRenderFault();
+  return S_OK;
+}
+
+//
+//  InjectFault()
+//
+//  Simulates the failures the watchdog handles: a capture client that errors out, a render device
+//  that is invalidated, or a capture event that stops firing.
+//
+HRESULT CLoopbackCapture::InjectFault(RouteFault fault) {
+  RETURN_HR_IF(E_NOT_VALID_STATE, m_DeviceState != DeviceState::Capturing);
+  {
+    auto lock = m_CritSec.lock();
+    RETURN_HR_IF(E_NOT_VALID_STATE, fault == RouteFault::Render && m_networkSink);
+  }
+
+  if (fault == RouteFault::Stall) {
+    auto lock = m_CritSec.lock();
+    if (0 != m_SampleReadyKey) {
+      MFCancelWorkItem(m_SampleReadyKey);
+      m_SampleReadyKey = 0;
+    }
+    return S_OK;
+  }
+
+  // Capture and render faults are raised by the audio thread itself, at its next wakeup.
+  m_injectedFault = fault;
+  return S_OK;
+}
+
 //
 //  OnSampleReady()
 //
@@ -292,7 +1076,7 @@ HRESULT CLoopbackCapture::OnSampleReady(IMFAsyncResult* pResult) {
     // Re-queue work item for next sample
     if (m_DeviceState == DeviceState::Capturing) {
       // Re-queue work item for next sample
-      return MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
+      return MFPutWaitingWorkItem(SampleReadyHandle(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
     }
   } else {
     m_DeviceState = DeviceState::Error;
@@ -304,7 +1088,7 @@ HRESULT CLoopbackCapture::OnSampleReady(IMFAsyncResult* pResult) {
 //
 //  OnAudioSampleRequested()
 //
-//  Called when audio device fires m_SampleReadyEvent
+//  Called when audio device fires m_SampleReadyEvent, or on each tick of a relaxed route's timer
 //
 HRESULT CLoopbackCapture::OnAudioSampleRequested() {
   UINT32 FramesAvailable = 0;
@@ -312,7 +1096,6 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested() {
   DWORD dwCaptureFlags;
   UINT64 u64DevicePosition = 0;
   UINT64 u64QPCPosition = 0;
-  DWORD cbBytesToCapture = 0;
 
   auto lock = m_CritSec.lock();
 
@@ -321,6 +1104,91 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested() {
     return S_OK;
   }
 
+  m_watchdog.NoteWakeup();
+
+  switch (m_injectedFault.exchange(RouteFault::None)) {
+    case RouteFault::Capture:
+      return AUDCLNT_E_DEVICE_INVALIDATED;
+    case RouteFault::Render:
+      m_watchdog.NoteRenderFault();
+      break;
+    default:
+      break;
+  }
+
+  // Account for this callback's CPU cost and how close it came to its deadline.
+  uint64_t cyclesAtStart = ThreadCycleCount();
+  // When the oldest packet of this wakeup finished being captured (its QPC position is that of its
+  // first frame); the packet couldn't have been delivered any earlier, so that's where its time
+  // against the deadline starts.
+  UINT64 oldestPacketEndQpc = 0;
+  uint64_t allocationsAtStart = ThreadAllocationCount();
+  auto accountCallback = wil::scope_exit([&]() {
+    m_stats.audioThreadAllocations.fetch_add(ThreadAllocationCount() - allocationsAtStart, std::memory_order_relaxed);
+    uint64_t cyclesAtEnd = ThreadCycleCount();
+    m_stats.callbackCycles.Record(cyclesAtEnd - cyclesAtStart);
+    m_stats.totalCallbackCycles.fetch_add(cyclesAtEnd - cyclesAtStart, std::memory_order_relaxed);
+    m_stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+
+    if (oldestPacketEndQpc != 0 && m_deadline > 0) {
+      UINT64 now = QpcNow100ns();
+      UINT64 elapsed = (now > oldestPacketEndQpc) ? now - oldestPacketEndQpc : 0;
+      UINT64 usagePercent = (elapsed * 100) / (UINT64) m_deadline;
+      m_stats.deadlineUsagePercent.Record(usagePercent);
+      if (usagePercent >= 100) {
+        m_stats.deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      if (m_activeParams.qosEnabled && m_qos.Update((uint32_t) min(usagePercent, (UINT64) UINT32_MAX))) {
+        QosLevel previous = static_cast<QosLevel>(m_stats.qosLevel.exchange(static_cast<uint32_t>(m_qos.Level()), std::memory_order_relaxed));
+        if (m_qos.Level() > previous) {
+          m_stats.qosSheds.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+  });
+
+  // Block boundary: pick up any parameters retuned through the control channel.
+  if (m_paramsHandoff.Consume()) {
+    m_activeParams = m_paramsHandoff.Front();
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_paramsApplyLatency.store(now.QuadPart - m_activeParams.publishQpc, std::memory_order_relaxed);
+
+    if (!m_activeParams.qosEnabled) {
+      m_qos.Reset();
+      m_stats.qosLevel.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Where this wakeup's packets go. The render side and the format only change under m_CritSec.
+  WasapiRenderTarget renderTarget(m_audioRenderClient.get());
+  RouteWakeup wakeup;
+  wakeup.sampleRate = m_waveFormat.get()->nSamplesPerSec;
+  wakeup.channels = m_waveFormat.get()->nChannels;
+  wakeup.blockAlign = m_waveFormat.get()->nBlockAlign;
+  wakeup.isFloat = m_outputIsFloat;
+  wakeup.processBuffer = m_processBuffer;
+  wakeup.processBufferFrames = m_processBufferFrames;
+  wakeup.gain = m_activeParams.gain;
+  wakeup.qosLevel = m_qos.Level();
+  wakeup.replay = m_replayBuffer.get();
+  wakeup.stream = m_networkSink.get();
+  wakeup.exclusive = m_outputExclusive;
+  wakeup.renderFormat = m_renderFormat;
+
+  // Under pressure the trace pauses, along with the replay history; it would only record the
+  // shedding anyway.
+  bool tracing = m_packetTrace && m_qos.Level() < QosLevel::NoHistory;
+  if (tracing) {
+    UINT32 renderPadding = 0;
+    if (!m_networkSink) {
+      m_audioClientForOutput->GetCurrentPadding(&renderPadding);
+    }
+    m_packetTrace->RecordWakeup(QpcNow100ns(), renderPadding);
+  }
+
   // A word on why we have a loop here;
   // Suppose it has been 10 milliseconds or so since the last time
   // this routine was invoked, and that we're capturing 48000 samples per second.
@@ -342,36 +1210,37 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested() {
   // We do this by calling IAudioCaptureClient::GetNextPacketSize
   // over and over again until it indicates there are no more packets remaining.
   while (SUCCEEDED(m_AudioCaptureClient->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0) {
-    cbBytesToCapture = FramesAvailable * m_waveFormat.get()->nBlockAlign;
-    assert(cbBytesToCapture > 0);
-
     // Get sample buffer
     RETURN_IF_FAILED(m_AudioCaptureClient->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, &u64DevicePosition, &u64QPCPosition));
 
+    if (oldestPacketEndQpc == 0 && (dwCaptureFlags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) == 0) {
+      oldestPacketEndQpc = u64QPCPosition + (UINT64) FramesAvailable * 10000000 / m_waveFormat.get()->nSamplesPerSec;
+    }
 
-    // Copy data to the render buffer
-    BYTE* outputBuffer = nullptr;
-    RETURN_IF_FAILED(m_audioRenderClient->GetBuffer(FramesAvailable, &outputBuffer));
-    memcpy(outputBuffer, Data, cbBytesToCapture);
-    m_audioRenderClient->ReleaseBuffer(FramesAvailable, 0);
-
+    if (tracing) {
+      m_packetTrace->RecordPacket(FramesAvailable, dwCaptureFlags, u64DevicePosition, u64QPCPosition);
+    }
 
-    // Write File
-#if 0
-    if (m_DeviceState != DeviceState::Stopping) {
-      DWORD dwBytesWritten = 0;
-      RETURN_IF_WIN32_BOOL_FALSE(WriteFile(
-        m_hFile.get(),
-        Data,
-        cbBytesToCapture,
-        &dwBytesWritten,
-        NULL));
+    // While the render side is down, keep draining capture so it doesn't stall as well; the
+    // watchdog rebuilds it.
+    wakeup.render = m_watchdog.RenderFaulted() ? nullptr : &renderTarget;
+
+    RoutePacket packet;
+    packet.data = Data;
+    packet.frames = FramesAvailable;
+    packet.flags = dwCaptureFlags;
+    packet.qpcPosition = u64QPCPosition;
+    if (m_pipeline.Process(wakeup, packet) == RenderStatus::Failed) {
+      m_watchdog.NoteRenderFault();
     }
-#endif
 
     // Release buffer back
     m_AudioCaptureClient->ReleaseBuffer(FramesAvailable);
   }
 
+  if (m_networkSink) {
+    m_networkSink->Flush();
+  }
+
   return S_OK;
 }
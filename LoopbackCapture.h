@@ -10,20 +10,82 @@
 #include <wil\com.h>
 #include <wil\result.h>
 
+#include <atomic>
+#include <memory>
+#include <string>
+
 #include "Common.h"
+#include "ExclusiveFormat.h"
+#include "PacketTrace.h"
+#include "QosPolicy.h"
+#include "ReplayBuffer.h"
+#include "RouteArena.h"
+#include "RoutePipeline.h"
+#include "RouteSpec.h"
+#include "RouteStats.h"
+#include "RouteWatchdog.h"
+#include "TripleBuffer.h"
 
 using namespace Microsoft::WRL;
 
+class CNetworkSink;
+
 class CLoopbackCapture :
-    public RuntimeClass< RuntimeClassFlags< ClassicCom >, FtmBase, IActivateAudioInterfaceCompletionHandler >
+    public RuntimeClass< RuntimeClassFlags< ClassicCom >, FtmBase, IActivateAudioInterfaceCompletionHandler >,
+    private WatchdogBackend
 {
 public:
     CLoopbackCapture();
     ~CLoopbackCapture();
 
-    void StartCaptureAsync(DWORD processId);
+    void StartCaptureAsync(DWORD processId, RouteSource::Mode mode = RouteSource::Mode::IncludeProcessTree);
+    // Safe to call whatever state the route is in, including straight after StartCaptureAsync().
     void StopCaptureAsync();
 
+    // Reselects the output device and render buffer. Must only be called while capture is stopped.
+    void SetOutput(const RouteOutput& output);
+    // Switches a running route to a new output device or render buffer length without stopping
+    // capture. Returns S_FALSE if the change can only be made by restarting the route.
+    HRESULT RetuneOutput(const RouteOutput& output);
+    // For status: how long the last output change took to reach the route, from the control
+    // channel accepting it (a QPC timestamp) to now.
+    void RecordOutputApplyLatency(LONGLONG requestQpc);
+
+    // Retunes a running route. Safe to call from any thread other than the audio thread; the new
+    // value takes effect at the start of the next captured block without interrupting the stream.
+    void SetGainDb(float gainDb);
+    // Lets the audio thread shed optional work (metering, then the replay history and packet trace,
+    // then dithered conversion) when its callbacks get close to their deadline. On by default.
+    void SetQosEnabled(bool enabled);
+
+    // Human-readable route state for the control channel.
+    std::wstring GetStatus();
+
+    // Per-route CPU cost and deadline accounting, for the control channel's stats command.
+    std::wstring GetStats() const;
+    void ResetStats();
+
+    // Opt-in recording of capture packet timing and render padding. Starting a trace discards any
+    // trace in progress; saving stops recording and writes the trace to a file.
+    void StartPacketTrace(size_t capacityBytes);
+    HRESULT SavePacketTrace(const std::wstring& path);
+
+    // Rolling instant-replay history of what the route has played. Starting replaces any history
+    // already held; saving writes the most recent audio to a WAV file and keeps recording.
+    HRESULT StartReplayBuffer(uint32_t seconds);
+    void StopReplayBuffer();
+    HRESULT SaveReplay(const std::wstring& path, uint32_t seconds);
+
+    // Watchdog. Called by the router thread every kWatchdogIntervalMs while a route is running; if
+    // the capture side has stopped waking up or either side has failed, tears down and rebuilds only
+    // the side that failed (see RouteWatchdog).
+    static const DWORD kWatchdogIntervalMs = RouteWatchdog::kCheckIntervalMs;
+    void CheckHealth();
+
+    // Fault injection for exercising the watchdog through the control channel.
+    enum class RouteFault { None, Capture, Render, Stall };
+    HRESULT InjectFault(RouteFault fault);
+
     METHODASYNCCALLBACK(CLoopbackCapture, StartCapture, OnStartCapture);
     METHODASYNCCALLBACK(CLoopbackCapture, StopCapture, OnStopCapture);
     METHODASYNCCALLBACK(CLoopbackCapture, SampleReady, OnSampleReady);
@@ -46,7 +108,30 @@ private:
         Stopped,
     };
 
-    void SelectAudioDevice();
+    // The output device and everything opened on it. OpenRenderSide() builds one off to the side,
+    // without the lock; it is then swapped in whole under m_CritSec.
+    struct RenderSide {
+      wil::com_ptr<IMMDevice> device;
+      wil::com_ptr<IAudioClient> client;
+      wil::com_ptr<IAudioRenderClient> renderClient;
+      // Capture format that feeds this device.
+      wil::unique_any<WAVEFORMATEX*, decltype(&::CoTaskMemFree), ::CoTaskMemFree> captureFormat;
+      bool captureIsFloat = false;
+      std::wstring deviceName;
+      bool exclusive = false;
+      PcmFormat format;
+      UINT32 blockAlign = 0;
+      UINT32 bufferFrames = 0;
+    };
+    void OpenRenderSide(const RouteOutput& output, RenderSide& side);
+    HRESULT InitializeExclusiveOutput(const RouteOutput& output, RenderSide& side);
+    void SwapRenderSide(RenderSide& side);
+    HRESULT InstallRenderSide(RenderSide& side);
+    void ReleaseExclusiveOutput();
+    bool CaptureFormatMatches(const RenderSide& side) const;
+    static UINT32 RenderBufferMs(const RouteOutput& output);
+    HRESULT StartRender();
+    HANDLE SampleReadyHandle() const;
 
     HRESULT OnStartCapture(IMFAsyncResult* pResult);
     HRESULT OnStopCapture(IMFAsyncResult* pResult);
@@ -57,27 +142,105 @@ private:
     HRESULT FixWAVHeader();
     HRESULT OnAudioSampleRequested();
 
-    void ActivateAudioInterface(DWORD processId);
+    void ActivateAudioInterface(DWORD processId, RouteSource::Mode mode);
     HRESULT FinishCaptureAsync();
 
     HRESULT SetDeviceStateErrorIfFailed(HRESULT hr);
 
+    HRESULT RecoverCapture(RenderSide* newRender = nullptr);
+    HRESULT RecoverRender(RenderSide& side);
+
+    // WatchdogBackend, for m_watchdog. Router thread only.
+    bool CaptureFailed() override;
+    bool CaptureHasQueuedData() override;
+    RebuildStatus RebuildRender() override;
+    bool RebuildCapture() override;
+
+    // Parameters that the audio thread picks up at block boundaries.
+    struct RouteParams {
+      float gain = 1.0f;
+      bool qosEnabled = true;
+      LONGLONG publishQpc = 0; // When these parameters were handed to the audio thread.
+    };
+    void PublishParams();
+
+    HRESULT AllocateRouteBuffers();
+
     wil::com_ptr_nothrow<IAudioClient> m_AudioClient;
     UINT32 m_BufferFrames = 0;
+    REFERENCE_TIME m_devicePeriod = 0; // Capture engine period (100ns), the deadline for each interactive wakeup
     wil::com_ptr_nothrow<IAudioCaptureClient> m_AudioCaptureClient;
     wil::com_ptr_nothrow<IMFAsyncResult> m_SampleReadyAsyncResult;
 
 
+    // The current render side, unpacked. Changed only by the router thread, under m_CritSec.
     wil::com_ptr<IMMDevice> m_audioOutputDevice;
     wil::com_ptr<IAudioClient> m_audioClientForOutput;
     wil::com_ptr<IAudioRenderClient> m_audioRenderClient;
     wil::unique_any<WAVEFORMATEX*, decltype(&::CoTaskMemFree), ::CoTaskMemFree>  m_waveFormat;
     uint32_t m_renderBufferSizeFrames = 0;
+    // When set, captured audio is streamed over the network and the render device is left idle.
+    // Replaced by the router thread under m_CritSec; other threads take a reference under it.
+    std::shared_ptr<CNetworkSink> m_networkSink;
+    RouteOutput m_output;
+    std::wstring m_outputDeviceName;
+    bool m_outputIsFloat = false;
+    // Render-side format. Differs from m_waveFormat (the capture format) only in exclusive mode,
+    // where captured floats are converted into whatever the device negotiated.
+    bool m_outputExclusive = false;
+    PcmFormat m_renderFormat;
+    UINT32 m_renderBlockAlign = 0;
+
+    // Writer-side copy of the route parameters, guarded by m_paramsLock.
+    RouteParams m_params;
+    wil::critical_section m_paramsLock;
+    TripleBuffer<RouteParams> m_paramsHandoff;
+    // Per-route intermediate buffers, sized by AllocateRouteBuffers() when the capture stream is
+    // initialized. The audio thread only ever uses these, never the heap.
+    RouteArena m_arena;
+    float* m_processBuffer = nullptr; // DSP output for one capture packet
+    UINT32 m_processBufferFrames = 0;
+
+    // Audio-thread copy of the route parameters.
+    RouteParams m_activeParams;
+    // Audio-thread policy for shedding the pipeline's optional stages.
+    QosPolicy m_qos;
+    // QPC ticks from the last PublishParams() to the audio thread applying it.
+    std::atomic<LONGLONG> m_paramsApplyLatency{ 0 };
+    // QPC ticks from the last output change being requested to it taking effect.
+    std::atomic<LONGLONG> m_outputApplyLatency{ 0 };
 
     wil::unique_event_nothrow m_SampleReadyEvent;
+    // Relaxed routes: instead of the engine's event, a periodic timer that the OS may coalesce with
+    // other wakeups, draining a capture buffer deep enough to hold a whole batch (see RouteSpec.h).
+    wil::unique_handle m_relaxedWakeupTimer;
+    bool m_relaxed = false; // Latency class the capture client was initialized with
+    REFERENCE_TIME m_wakeupPeriod = 0; // How often the callback runs (100ns)
+    REFERENCE_TIME m_deadline = 0; // How long a captured packet can wait before the render queue runs dry (100ns)
+    std::atomic<UINT64> m_statsSince{ 0 }; // 100ns QPC time of the last stats reset
     MFWORKITEM_KEY m_SampleReadyKey = 0;
 
     wil::critical_section m_CritSec;
+    RouteStats m_stats;
+    // The per-packet routing step, run by the audio thread. Also holds the peak meter.
+    RoutePipeline m_pipeline;
+
+    // Watchdog state. The audio thread stamps every wakeup and flags render failures; the router
+    // thread acts on them in CheckHealth().
+    RouteWatchdog m_watchdog;
+    DWORD m_processId = 0;
+    RouteSource::Mode m_processMode = RouteSource::Mode::IncludeProcessTree;
+    std::atomic<RouteFault> m_injectedFault{ RouteFault::None };
+    // Router thread only: a rebuilt render device waiting for capture to follow it to a new
+    // format, and the result of the last rebuild, for the log.
+    RenderSide m_pendingRender;
+    HRESULT m_lastRebuildResult = S_OK;
+
+    // Packet timing recorder, if a trace was requested. Guarded by m_CritSec.
+    std::unique_ptr<PacketTraceWriter> m_packetTrace;
+    // Instant-replay history, if enabled. Guarded by m_CritSec, but readers take a reference and
+    // snapshot it outside the lock so saving never holds up the audio thread.
+    std::shared_ptr<ReplayBuffer> m_replayBuffer;
     DWORD m_dwQueueID = 0;
 
     // These two members are used to communicate between the main thread
@@ -87,4 +250,5 @@ private:
     DeviceState m_DeviceState{ DeviceState::Uninitialized };
     wil::unique_event_nothrow m_hActivateCompleted;
     wil::unique_event_nothrow m_hCaptureStopped;
+    wil::unique_event_nothrow m_hCaptureStarted;
 };
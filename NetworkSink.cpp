@@ -0,0 +1,106 @@
+#include "NetworkSink.h"
+
+#include <WS2tcpip.h>
+#include <ksmedia.h>
+#include <sstream>
+
+#include <wil\resource.h>
+#include <wil\result.h>
+
+#include "RouteSpec.h"
+
+CNetworkSink::CNetworkSink() : m_packetizer(*this) {
+}
+
+CNetworkSink::~CNetworkSink() {
+  if (m_socket != INVALID_SOCKET) {
+    closesocket(m_socket);
+  }
+  if (m_winsockStarted) {
+    WSACleanup();
+  }
+}
+
+HRESULT CNetworkSink::Open(const std::wstring& destination, const WAVEFORMATEX* format) {
+  // Work out how to turn capture frames into L16.
+  bool isExtensible = (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE);
+  bool sourceIsFloat;
+  const GUID& subFormat = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(format)->SubFormat;
+  if (format->wBitsPerSample == 32 && (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT || (isExtensible && IsEqualGUID(subFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)))) {
+    sourceIsFloat = true;
+  } else if (format->wBitsPerSample == 16 && (format->wFormatTag == WAVE_FORMAT_PCM || (isExtensible && IsEqualGUID(subFormat, KSDATAFORMAT_SUBTYPE_PCM)))) {
+    sourceIsFloat = false;
+  } else {
+    RETURN_HR_MSG(E_INVALIDARG, "AudioRouter: Network sink only supports 32-bit float or 16-bit PCM capture formats.");
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  uint32_t ssrc = (uint32_t) (now.QuadPart ^ (now.QuadPart >> 32)) ^ GetCurrentProcessId();
+  RETURN_HR_IF(E_INVALIDARG, !m_packetizer.Reset(format->nChannels, format->nSamplesPerSec, sourceIsFloat, (uint16_t) now.QuadPart, ssrc));
+
+  std::wstring host, port;
+  RETURN_HR_IF_MSG(E_INVALIDARG, !ParseStreamDestination(destination, host, port), "AudioRouter: Stream destination must be host:port or [IPv6 address]:port.");
+
+  WSADATA wsaData;
+  RETURN_IF_WIN32_ERROR(WSAStartup(MAKEWORD(2, 2), &wsaData));
+  m_winsockStarted = true;
+
+  ADDRINFOW hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  ADDRINFOW* addresses = nullptr;
+  RETURN_IF_WIN32_ERROR(GetAddrInfoW(host.c_str(), port.c_str(), &hints, &addresses));
+  wil::unique_any<ADDRINFOW*, decltype(&::FreeAddrInfoW), ::FreeAddrInfoW> addressesOwner(addresses);
+
+  m_socket = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+  RETURN_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), m_socket == INVALID_SOCKET);
+
+  // Connecting the UDP socket fixes the destination, so each datagram is a plain send().
+  RETURN_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), connect(m_socket, addresses->ai_addr, (int) addresses->ai_addrlen) == SOCKET_ERROR);
+
+  // Leave room for a few periods of audio in the socket buffer so bursts are not dropped locally.
+  int sendBufferSize = 256 * 1024;
+  setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&sendBufferSize), sizeof(sendBufferSize));
+
+  // send() runs on the audio thread, so it must never wait for buffer space.
+  u_long nonBlocking = 1;
+  RETURN_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), ioctlsocket(m_socket, FIONBIO, &nonBlocking) == SOCKET_ERROR);
+
+  m_destination = destination;
+
+  return S_OK;
+}
+
+void CNetworkSink::Append(const uint8_t* data, uint32_t frameCount, uint64_t qpcPosition, bool silent) {
+  m_packetizer.Append(data, frameCount, qpcPosition, silent);
+}
+
+void CNetworkSink::Flush() {
+  m_packetizer.Flush();
+}
+
+void CNetworkSink::SendPacket(const uint8_t* packet, uint32_t size) {
+  // UDP: a failed or short send just loses this packet; the receiver's jitter buffer covers it.
+  // A full socket buffer means the network can't keep up, which is a drop rather than an error.
+  int sent = send(m_socket, reinterpret_cast<const char*>(packet), (int) size, 0);
+  if (sent == (int) size) {
+    m_packetsSent.fetch_add(1, std::memory_order_relaxed);
+    m_bytesSent.fetch_add(size, std::memory_order_relaxed);
+  } else if (sent == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+    m_packetsDropped.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    m_sendErrors.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::wstring CNetworkSink::GetStatus() const {
+  std::wstringstream ss;
+  ss << L"stream=rtp://" << m_destination
+     << L" payload=L16/" << m_packetizer.SampleRate() << L"/" << m_packetizer.Channels()
+     << L" packetsSent=" << m_packetsSent.load(std::memory_order_relaxed)
+     << L" bytesSent=" << m_bytesSent.load(std::memory_order_relaxed)
+     << L" packetsDropped=" << m_packetsDropped.load(std::memory_order_relaxed)
+     << L" sendErrors=" << m_sendErrors.load(std::memory_order_relaxed);
+  return ss.str();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <mmreg.h>
+#include <atomic>
+#include <string>
+
+#include "RoutePipeline.h"
+#include "RtpPacketizer.h"
+
+//
+//  CNetworkSink
+//
+//  Streams captured frames to another machine as RTP/UDP (L16 payload). RtpPacketizer builds the
+//  datagrams; this class owns the socket they go out on.
+//
+class CNetworkSink : public StreamTarget, private RtpPacketSender {
+public:
+  CNetworkSink();
+  ~CNetworkSink();
+
+  // Resolves "host:port" or "[IPv6 address]:port" and prepares packetization for the given capture format.
+  // Must be called before streaming starts, off the audio thread.
+  HRESULT Open(const std::wstring& destination, const WAVEFORMATEX* format);
+
+  // Audio thread: packetizes frames captured at qpcPosition (100ns units, as reported by
+  // IAudioCaptureClient::GetBuffer). Full packets are sent immediately, on a non-blocking socket;
+  // a packet that doesn't fit in the socket buffer is dropped and counted.
+  void Append(const uint8_t* data, uint32_t frameCount, uint64_t qpcPosition, bool silent) override;
+
+  // Audio thread: sends any partially filled packet. Called once at the end of each wakeup.
+  void Flush();
+
+  // Describes the stream in SDP-like terms so a receiver can be configured to match.
+  std::wstring GetStatus() const;
+
+private:
+  void SendPacket(const uint8_t* packet, uint32_t size) override;
+
+  SOCKET m_socket = INVALID_SOCKET;
+  bool m_winsockStarted = false;
+  std::wstring m_destination;
+  RtpPacketizer m_packetizer;
+
+  std::atomic<uint64_t> m_packetsSent{ 0 };
+  std::atomic<uint64_t> m_bytesSent{ 0 };
+  std::atomic<uint64_t> m_packetsDropped{ 0 }; // socket buffer full
+  std::atomic<uint64_t> m_sendErrors{ 0 };
+};
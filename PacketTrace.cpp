@@ -0,0 +1,172 @@
+#include "PacketTrace.h"
+
+#include <string.h>
+
+// File layout (little-endian):
+//   char[4]  magic "ARPT"
+//   uint32   version
+//   uint32   sampleRate, channels, captureBufferFrames, renderBufferFrames
+//   uint32   flags (bit 0: truncated)
+//   uint64   event byte count
+//   events
+// Each event is a tag byte followed by varints. Times are zigzag deltas from the previous event's
+// time; device positions are zigzag deltas from where the previous packet ended.
+static const uint8_t kMagic[4] = { 'A', 'R', 'P', 'T' };
+static const uint32_t kVersion = 1;
+static const size_t kHeaderSize = 4 + 4 + 16 + 4 + 8;
+static const size_t kMaxEventSize = 1 + 4 * 10; // tag + four varints
+
+enum : uint8_t {
+  kTagWakeup = 1,
+  kTagPacket = 2,
+};
+
+static void PutU32(std::vector<uint8_t>& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    out.push_back((uint8_t) (value >> (i * 8)));
+}
+
+static uint32_t GetU32(const uint8_t* src) {
+  return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+PacketTraceWriter::PacketTraceWriter(size_t capacityBytes, const PacketTraceFormat& format) :
+  m_format(format), m_buffer(new uint8_t[capacityBytes]), m_capacity(capacityBytes) {
+}
+
+bool PacketTraceWriter::Reserve() {
+  if (m_truncated || m_capacity - m_size < kMaxEventSize) {
+    m_truncated = true;
+    return false;
+  }
+  return true;
+}
+
+void PacketTraceWriter::PutVarint(uint64_t value) {
+  while (value >= 0x80) {
+    m_buffer[m_size++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  m_buffer[m_size++] = (uint8_t) value;
+}
+
+void PacketTraceWriter::PutSigned(int64_t value) {
+  PutVarint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63)); // zigzag
+}
+
+void PacketTraceWriter::RecordWakeup(uint64_t qpc, uint32_t renderPadding) {
+  if (!Reserve())
+    return;
+  m_buffer[m_size++] = kTagWakeup;
+  PutSigned((int64_t) (qpc - m_lastQpc));
+  PutVarint(renderPadding);
+  m_lastQpc = qpc;
+}
+
+void PacketTraceWriter::RecordPacket(uint32_t frames, uint32_t flags, uint64_t devicePosition, uint64_t qpcPosition) {
+  if (!Reserve())
+    return;
+  m_buffer[m_size++] = kTagPacket;
+  PutVarint(frames);
+  PutVarint(flags);
+  PutSigned((int64_t) (devicePosition - m_expectedDevicePosition));
+  PutSigned((int64_t) (qpcPosition - m_lastQpc));
+  m_lastQpc = qpcPosition;
+  m_expectedDevicePosition = devicePosition + frames;
+}
+
+void PacketTraceWriter::Serialize(std::vector<uint8_t>& out) const {
+  out.clear();
+  out.reserve(kHeaderSize + m_size);
+  out.insert(out.end(), kMagic, kMagic + 4);
+  PutU32(out, kVersion);
+  PutU32(out, m_format.sampleRate);
+  PutU32(out, m_format.channels);
+  PutU32(out, m_format.captureBufferFrames);
+  PutU32(out, m_format.renderBufferFrames);
+  PutU32(out, m_truncated ? 1 : 0);
+  PutU32(out, (uint32_t) m_size);
+  PutU32(out, (uint32_t) ((uint64_t) m_size >> 32));
+  out.insert(out.end(), m_buffer.get(), m_buffer.get() + m_size);
+}
+
+bool PacketTraceReader::Open(const uint8_t* data, size_t size) {
+  if (size < kHeaderSize || memcmp(data, kMagic, 4) != 0 || GetU32(data + 4) != kVersion)
+    return false;
+
+  m_format.sampleRate = GetU32(data + 8);
+  m_format.channels = GetU32(data + 12);
+  m_format.captureBufferFrames = GetU32(data + 16);
+  m_format.renderBufferFrames = GetU32(data + 20);
+  m_truncated = (GetU32(data + 24) & 1) != 0;
+  uint64_t eventBytes = (uint64_t) GetU32(data + 28) | ((uint64_t) GetU32(data + 32) << 32);
+  if (eventBytes > size - kHeaderSize)
+    return false;
+
+  m_cursor = data + kHeaderSize;
+  m_end = m_cursor + eventBytes;
+  m_lastQpc = 0;
+  m_expectedDevicePosition = 0;
+  return true;
+}
+
+bool PacketTraceReader::GetVarint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (m_cursor == m_end)
+      return false;
+    uint8_t byte = *m_cursor++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool PacketTraceReader::GetSigned(int64_t& value) {
+  uint64_t encoded;
+  if (!GetVarint(encoded))
+    return false;
+  value = (int64_t) (encoded >> 1) ^ -(int64_t) (encoded & 1);
+  return true;
+}
+
+bool PacketTraceReader::Next(PacketTraceEvent& event) {
+  if (m_cursor == m_end)
+    return false;
+
+  uint8_t tag = *m_cursor++;
+  event = PacketTraceEvent();
+  int64_t qpcDelta;
+  uint64_t value;
+
+  switch (tag) {
+    case kTagWakeup:
+      event.type = PacketTraceEvent::Type::Wakeup;
+      if (!GetSigned(qpcDelta) || !GetVarint(value))
+        return false;
+      event.qpc = m_lastQpc + qpcDelta;
+      event.renderPadding = (uint32_t) value;
+      break;
+
+    case kTagPacket: {
+      event.type = PacketTraceEvent::Type::Packet;
+      int64_t devicePositionDelta;
+      uint64_t flags;
+      if (!GetVarint(value) || !GetVarint(flags) || !GetSigned(devicePositionDelta) || !GetSigned(qpcDelta))
+        return false;
+      event.frames = (uint32_t) value;
+      event.flags = (uint32_t) flags;
+      event.devicePosition = m_expectedDevicePosition + devicePositionDelta;
+      event.qpc = m_lastQpc + qpcDelta;
+      m_expectedDevicePosition = event.devicePosition + event.frames;
+      break;
+    }
+
+    default:
+      return false;
+  }
+
+  m_lastQpc = event.qpc;
+  return true;
+}
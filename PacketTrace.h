@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+// Compact recording of the capture packet timing seen by the router, for reproducing field glitches.
+// Every IAudioCaptureClient::GetBuffer result and every render padding sample is stored as a small
+// delta/varint-encoded event, so a few MB covers hours of streaming. Free of Windows types so traces
+// can be decoded and replayed on any platform.
+
+// Capture flags as reported by GetBuffer (AUDCLNT_BUFFERFLAGS_*).
+#define PACKET_TRACE_FLAG_DATA_DISCONTINUITY 0x1
+#define PACKET_TRACE_FLAG_SILENT 0x2
+#define PACKET_TRACE_FLAG_TIMESTAMP_ERROR 0x4
+
+struct PacketTraceFormat {
+  uint32_t sampleRate = 0;
+  uint32_t channels = 0;
+  uint32_t captureBufferFrames = 0;
+  uint32_t renderBufferFrames = 0; // 0 if the route was streaming to the network
+};
+
+struct PacketTraceEvent {
+  enum class Type {
+    Wakeup, // The capture callback ran. qpc is the wakeup time, renderPadding the render queue depth
+            // (0 while streaming to the network).
+    Packet, // One GetBuffer result.
+  };
+
+  Type type = Type::Wakeup;
+  uint64_t qpc = 0; // 100ns units, same clock as GetBuffer's QPC position
+  uint32_t renderPadding = 0;
+  uint32_t frames = 0;
+  uint32_t flags = 0;
+  uint64_t devicePosition = 0;
+};
+
+//
+//  PacketTraceWriter
+//
+//  Appends events to a buffer allocated up front, so recording never allocates on the audio thread.
+//  Recording stops (and the trace is marked truncated) when the buffer fills up.
+//
+class PacketTraceWriter {
+public:
+  PacketTraceWriter(size_t capacityBytes, const PacketTraceFormat& format);
+
+  void RecordWakeup(uint64_t qpc, uint32_t renderPadding);
+  void RecordPacket(uint32_t frames, uint32_t flags, uint64_t devicePosition, uint64_t qpcPosition);
+
+  size_t EventBytes() const { return m_size; }
+  bool IsTruncated() const { return m_truncated; }
+
+  // Header followed by the recorded events, ready to be written to a file.
+  void Serialize(std::vector<uint8_t>& out) const;
+
+private:
+  bool Reserve();
+  void PutVarint(uint64_t value);
+  void PutSigned(int64_t value);
+
+  PacketTraceFormat m_format;
+  std::unique_ptr<uint8_t[]> m_buffer;
+  size_t m_capacity;
+  size_t m_size = 0;
+  bool m_truncated = false;
+
+  uint64_t m_lastQpc = 0;
+  uint64_t m_expectedDevicePosition = 0;
+};
+
+class PacketTraceReader {
+public:
+  // Parses the header. The data must outlive the reader.
+  bool Open(const uint8_t* data, size_t size);
+
+  const PacketTraceFormat& Format() const { return m_format; }
+  bool IsTruncated() const { return m_truncated; }
+
+  // Returns false at the end of the trace or if the data is corrupt.
+  bool Next(PacketTraceEvent& event);
+
+private:
+  bool GetVarint(uint64_t& value);
+  bool GetSigned(int64_t& value);
+
+  PacketTraceFormat m_format;
+  bool m_truncated = false;
+  const uint8_t* m_cursor = nullptr;
+  const uint8_t* m_end = nullptr;
+
+  uint64_t m_lastQpc = 0;
+  uint64_t m_expectedDevicePosition = 0;
+};
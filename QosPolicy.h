@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+// Optional work the routing pipeline sheds under CPU pressure, in the order it is given up. Each
+// level also sheds everything before it. Work nobody hears goes first; what the route sounds like
+// goes last. The gain stage is not on the list: it is part of what the user asked the route to
+// sound like, and dropping it would be a far more audible jump than the glitch it was meant to
+// prevent.
+enum class QosLevel : uint32_t {
+  Full = 0,       // everything runs
+  NoMetering,     // peak meter off
+  NoHistory,      // plus the replay history records silence instead of encoding, and a packet trace pauses
+  FastConversion, // plus exclusive-mode PCM conversion without dither
+};
+
+//
+//  QosPolicy
+//
+//  Decides how much optional work the audio thread sheds, from how much of its deadline recent
+//  callbacks used. A level is shed when the smoothed usage crosses kShedPercent, at most once every
+//  kShedHoldoff callbacks so each step has time to show in the average. Each callback counts for at
+//  most kUsageCapPercent, so a single long stall (a page fault, a preemption) can't shed by itself;
+//  only sustained pressure does. A level is restored only after kRestoreHoldoff consecutive
+//  callbacks under kRestorePercent, so the policy doesn't flap. A stage can cost more than the
+//  headroom it is restored into, though (the replay encoder costs several times what the rest of
+//  the pipeline does), so a level that has to be shed again within kRestoreProbation callbacks of
+//  being restored doubles the holdoff before the next try, up to kMaxRestoreHoldoff; a restore that
+//  holds resets it. Audio thread only.
+//
+class QosPolicy {
+public:
+  static const uint32_t kShedPercent = 75;
+  static const uint32_t kRestorePercent = 40;
+  static const uint32_t kUsageCapPercent = 200;
+  static const uint32_t kShedHoldoff = 32;
+  static const uint32_t kRestoreHoldoff = 200;
+  static const uint32_t kRestoreProbation = 2 * kRestoreHoldoff;
+  static const uint32_t kMaxRestoreHoldoff = 8 * kRestoreHoldoff;
+
+  QosLevel Level() const { return m_level; }
+
+  // Feeds one callback's deadline usage, in percent. Returns true if the level changed.
+  bool Update(uint32_t usagePercent) {
+    // Moving average with weight 1/8, kept scaled by 8 to stay in integers.
+    if (usagePercent > kUsageCapPercent)
+      usagePercent = kUsageCapPercent;
+    m_smoothedX8 = m_smoothedX8 - m_smoothedX8 / 8 + usagePercent;
+    uint32_t smoothed = m_smoothedX8 / 8;
+    if (m_sinceChange < kShedHoldoff)
+      m_sinceChange++;
+    if (m_sinceRestore < kRestoreProbation && ++m_sinceRestore == kRestoreProbation)
+      m_restoreHoldoff = kRestoreHoldoff; // the last restore held
+
+    if (smoothed >= kShedPercent) {
+      m_restoreStreak = 0;
+      if (m_level == QosLevel::FastConversion || m_sinceChange < kShedHoldoff)
+        return false;
+      if (m_sinceRestore < kRestoreProbation) {
+        // What was just restored didn't fit; wait longer before trying it again.
+        m_restoreHoldoff = (m_restoreHoldoff < kMaxRestoreHoldoff) ? 2 * m_restoreHoldoff : kMaxRestoreHoldoff;
+        m_sinceRestore = kRestoreProbation;
+      }
+      m_level = static_cast<QosLevel>(static_cast<uint32_t>(m_level) + 1);
+      m_sinceChange = 0;
+      return true;
+    }
+
+    if (smoothed >= kRestorePercent || m_level == QosLevel::Full) {
+      m_restoreStreak = 0;
+      return false;
+    }
+    if (++m_restoreStreak < m_restoreHoldoff)
+      return false;
+    m_level = static_cast<QosLevel>(static_cast<uint32_t>(m_level) - 1);
+    m_restoreStreak = 0;
+    m_sinceChange = 0;
+    m_sinceRestore = 0;
+    return true;
+  }
+
+  void Reset() {
+    m_level = QosLevel::Full;
+    m_smoothedX8 = 0;
+    m_sinceChange = kShedHoldoff;
+    m_restoreStreak = 0;
+    m_restoreHoldoff = kRestoreHoldoff;
+    m_sinceRestore = kRestoreProbation;
+  }
+
+  // Callbacks a level currently has to stay under kRestorePercent before it is restored.
+  uint32_t RestoreHoldoff() const { return m_restoreHoldoff; }
+
+private:
+  QosLevel m_level = QosLevel::Full;
+  uint32_t m_smoothedX8 = 0;
+  uint32_t m_sinceChange = kShedHoldoff;
+  uint32_t m_restoreStreak = 0;
+  uint32_t m_restoreHoldoff = kRestoreHoldoff;
+  uint32_t m_sinceRestore = kRestoreProbation;
+};
@@ -0,0 +1,235 @@
+#include "ReplayBuffer.h"
+
+#include <string.h>
+#include <atomic>
+
+// Microsoft IMA ADPCM block layout: for each channel a 4-byte header (int16 sample, uint8 step
+// index, reserved), then the remaining samples in runs of 8 four-bit codes (4 bytes) per channel,
+// channels interleaved run by run. The header sample counts as the block's first frame.
+static const uint32_t kBlockBytesPerChannel = 512;
+static const uint16_t kWaveFormatImaAdpcm = 0x0011;
+
+static const int32_t kStepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73,
+  80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
+  544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+  2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+  12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int32_t kIndexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Advances the decoder state by one code. The encoder runs the same update so both sides agree.
+static void DecodeNibble(uint8_t nibble, int32_t& predictor, int32_t& stepIndex) {
+  int32_t step = kStepTable[stepIndex];
+  int32_t delta = step >> 3;
+  if (nibble & 4)
+    delta += step;
+  if (nibble & 2)
+    delta += step >> 1;
+  if (nibble & 1)
+    delta += step >> 2;
+  predictor += (nibble & 8) ? -delta : delta;
+  predictor = (predictor > 32767) ? 32767 : ((predictor < -32768) ? -32768 : predictor);
+  stepIndex += kIndexTable[nibble];
+  stepIndex = (stepIndex > 88) ? 88 : ((stepIndex < 0) ? 0 : stepIndex);
+}
+
+static uint8_t EncodeSample(int32_t sample, int32_t& predictor, int32_t& stepIndex) {
+  int32_t diff = sample - predictor;
+  uint8_t nibble = 0;
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+  int32_t step = kStepTable[stepIndex];
+  if (diff >= step) {
+    nibble |= 4;
+    diff -= step;
+  }
+  if (diff >= (step >> 1)) {
+    nibble |= 2;
+    diff -= step >> 1;
+  }
+  if (diff >= (step >> 2)) {
+    nibble |= 1;
+  }
+  DecodeNibble(nibble, predictor, stepIndex);
+  return nibble;
+}
+
+static int16_t FloatToInt16(float sample) {
+  float scaled = sample * 32768.0f;
+  if (scaled >= 32767.0f)
+    return 32767;
+  if (scaled <= -32768.0f)
+    return -32768;
+  return (int16_t) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+static void PutU16(std::vector<uint8_t>& out, uint16_t value) {
+  out.push_back((uint8_t) value);
+  out.push_back((uint8_t) (value >> 8));
+}
+
+static void PutU32(std::vector<uint8_t>& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    out.push_back((uint8_t) (value >> (i * 8)));
+}
+
+static void PutTag(std::vector<uint8_t>& out, const char* tag) {
+  out.insert(out.end(), tag, tag + 4);
+}
+
+ReplayBuffer::ReplayBuffer(uint32_t sampleRate, uint32_t channels, uint32_t seconds) :
+  m_sampleRate(sampleRate), m_channels(channels) {
+  m_blockAlign = kBlockBytesPerChannel * channels;
+  m_samplesPerBlock = (kBlockBytesPerChannel - 4) * 2 + 1;
+
+  uint64_t frames = (uint64_t) sampleRate * seconds;
+  m_blockCount = (size_t) ((frames + m_samplesPerBlock - 1) / m_samplesPerBlock) + 1;
+  m_blocks.reset(new uint8_t[m_blockCount * m_blockAlign]);
+
+  m_staging.reset(new int16_t[m_samplesPerBlock * channels]);
+  m_predictor.reset(new int32_t[channels]());
+  m_stepIndex.reset(new int32_t[channels]());
+}
+
+void ReplayBuffer::Append(const float* samples, uint32_t frames) {
+  while (frames > 0) {
+    uint32_t chunk = m_samplesPerBlock - m_stagedFrames;
+    if (chunk > frames)
+      chunk = frames;
+    int16_t* staged = &m_staging[m_stagedFrames * m_channels];
+    for (uint32_t i = 0; i < chunk * m_channels; ++i) {
+      staged[i] = FloatToInt16(samples[i]);
+    }
+    m_stagedSilence = false;
+    samples += chunk * m_channels;
+    frames -= chunk;
+    CompleteFrames(chunk);
+  }
+}
+
+void ReplayBuffer::AppendSilence(uint32_t frames) {
+  while (frames > 0) {
+    uint32_t chunk = m_samplesPerBlock - m_stagedFrames;
+    if (chunk > frames)
+      chunk = frames;
+    memset(&m_staging[m_stagedFrames * m_channels], 0, chunk * m_channels * sizeof(int16_t));
+    frames -= chunk;
+    CompleteFrames(chunk);
+  }
+}
+
+void ReplayBuffer::CompleteFrames(uint32_t frames) {
+  m_stagedFrames += frames;
+  if (m_stagedFrames < m_samplesPerBlock)
+    return;
+
+  uint64_t blockIndex = m_blocksWritten.load(std::memory_order_relaxed);
+  uint8_t* block = &m_blocks[(size_t) (blockIndex % m_blockCount) * m_blockAlign];
+  if (m_stagedSilence) {
+    // An all-zero block (first sample 0, step index 0, every code 0) decodes to exact silence, and
+    // leaves the encoder where it would start from.
+    memset(block, 0, m_blockAlign);
+    for (uint32_t channel = 0; channel < m_channels; ++channel) {
+      m_predictor[channel] = 0;
+      m_stepIndex[channel] = 0;
+    }
+  } else {
+    EncodeBlock(block);
+  }
+  m_stagedFrames = 0;
+  m_stagedSilence = true;
+  // Publishes the block's bytes to readers.
+  m_blocksWritten.store(blockIndex + 1, std::memory_order_release);
+}
+
+void ReplayBuffer::EncodeBlock(uint8_t* block) {
+  const int16_t* staged = m_staging.get();
+
+  // The first frame goes into the headers verbatim, which also resynchronizes the predictor.
+  for (uint32_t channel = 0; channel < m_channels; ++channel) {
+    int16_t sample = staged[channel];
+    m_predictor[channel] = sample;
+    block[0] = (uint8_t) sample;
+    block[1] = (uint8_t) ((uint16_t) sample >> 8);
+    block[2] = (uint8_t) m_stepIndex[channel];
+    block[3] = 0;
+    block += 4;
+  }
+
+  for (uint32_t frame = 1; frame < m_samplesPerBlock; frame += 8) {
+    for (uint32_t channel = 0; channel < m_channels; ++channel) {
+      for (uint32_t i = 0; i < 8; i += 2) {
+        uint8_t low = EncodeSample(staged[(frame + i) * m_channels + channel], m_predictor[channel], m_stepIndex[channel]);
+        uint8_t high = EncodeSample(staged[(frame + i + 1) * m_channels + channel], m_predictor[channel], m_stepIndex[channel]);
+        *block++ = (uint8_t) (low | (high << 4));
+      }
+    }
+  }
+}
+
+uint32_t ReplayBuffer::SecondsHeld() const {
+  uint64_t written = m_blocksWritten.load(std::memory_order_relaxed);
+  uint64_t held = (written < m_blockCount - 1) ? written : m_blockCount - 1;
+  return (uint32_t) (held * m_samplesPerBlock / m_sampleRate);
+}
+
+uint32_t ReplayBuffer::BytesPerMinute() const {
+  return (uint32_t) ((uint64_t) m_blockAlign * m_sampleRate * 60 / m_samplesPerBlock);
+}
+
+bool ReplayBuffer::Snapshot(uint32_t seconds, std::vector<uint8_t>& wavFile) const {
+  uint64_t end = m_blocksWritten.load(std::memory_order_acquire);
+  uint64_t wanted = ((uint64_t) seconds * m_sampleRate + m_samplesPerBlock - 1) / m_samplesPerBlock;
+  // The slot after the newest block may be mid-encode, so at most m_blockCount - 1 are stable.
+  uint64_t available = (end < m_blockCount - 1) ? end : m_blockCount - 1;
+  uint64_t count = (wanted < available) ? wanted : available;
+  uint64_t begin = end - count;
+
+  std::vector<uint8_t> blocks((size_t) (count * m_blockAlign));
+  for (uint64_t block = begin; block < end; ++block) {
+    memcpy(&blocks[(size_t) ((block - begin) * m_blockAlign)], &m_blocks[(size_t) (block % m_blockCount) * m_blockAlign], m_blockAlign);
+  }
+
+  // Anything the writer reached while we were copying has been overwritten; drop it from the front.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t endAfterCopy = m_blocksWritten.load(std::memory_order_relaxed);
+  uint64_t firstIntact = (endAfterCopy + 1 > m_blockCount) ? endAfterCopy + 1 - m_blockCount : 0;
+  if (firstIntact > begin) {
+    uint64_t dropped = (firstIntact < end ? firstIntact : end) - begin;
+    blocks.erase(blocks.begin(), blocks.begin() + (size_t) (dropped * m_blockAlign));
+    count -= dropped;
+  }
+  if (count == 0)
+    return false;
+
+  uint32_t dataBytes = (uint32_t) blocks.size();
+  wavFile.clear();
+  wavFile.reserve(dataBytes + 60);
+  PutTag(wavFile, "RIFF");
+  PutU32(wavFile, 4 + (8 + 20) + (8 + 4) + (8 + dataBytes));
+  PutTag(wavFile, "WAVE");
+
+  PutTag(wavFile, "fmt ");
+  PutU32(wavFile, 20);
+  PutU16(wavFile, kWaveFormatImaAdpcm);
+  PutU16(wavFile, (uint16_t) m_channels);
+  PutU32(wavFile, m_sampleRate);
+  PutU32(wavFile, (uint32_t) ((uint64_t) m_blockAlign * m_sampleRate / m_samplesPerBlock)); // nAvgBytesPerSec
+  PutU16(wavFile, (uint16_t) m_blockAlign);
+  PutU16(wavFile, 4); // wBitsPerSample
+  PutU16(wavFile, 2); // cbSize
+  PutU16(wavFile, (uint16_t) m_samplesPerBlock);
+
+  PutTag(wavFile, "fact");
+  PutU32(wavFile, 4);
+  PutU32(wavFile, (uint32_t) (count * m_samplesPerBlock));
+
+  PutTag(wavFile, "data");
+  PutU32(wavFile, dataBytes);
+  wavFile.insert(wavFile.end(), blocks.begin(), blocks.end());
+  return true;
+}
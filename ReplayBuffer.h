@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Rolling in-memory history of a route for "save the last N minutes" after the fact. Audio is
+// stored as IMA ADPCM (4 bits per sample, about 2.9 MB per minute of 48 kHz stereo), so half an
+// hour fits in under 90 MB, and a dump is a standard WAVE_FORMAT_IMA_ADPCM file any player can
+// open. Free of Windows types, like PacketTrace.
+
+//
+//  ReplayBuffer
+//
+//  Single writer (the audio thread), any number of readers. The writer encodes into a ring of
+//  fixed-size ADPCM blocks allocated up front and never blocks or allocates; a reader copies the
+//  ring out and throws away any blocks the writer overwrote while it was copying.
+//
+class ReplayBuffer {
+public:
+  // Holds at least `seconds` of audio at the given format.
+  ReplayBuffer(uint32_t sampleRate, uint32_t channels, uint32_t seconds);
+
+  uint32_t SampleRate() const { return m_sampleRate; }
+  uint32_t Channels() const { return m_channels; }
+
+  // Audio thread only. Appends interleaved float samples, or the same number of frames of silence.
+  void Append(const float* samples, uint32_t frames);
+  void AppendSilence(uint32_t frames);
+
+  // Blocks completed since construction, and the cost of keeping them.
+  uint64_t BlocksEncoded() const { return m_blocksWritten.load(std::memory_order_relaxed); }
+  uint32_t SecondsHeld() const;
+  size_t MemoryBytes() const { return m_blockCount * m_blockAlign; }
+  uint32_t BytesPerMinute() const;
+
+  // Builds a WAV file of the most recent `seconds` of audio (or everything held, if less).
+  // Returns false if nothing has been recorded yet. Safe to call while the writer is running.
+  bool Snapshot(uint32_t seconds, std::vector<uint8_t>& wavFile) const;
+
+private:
+  void EncodeBlock(uint8_t* block);
+  void CompleteFrames(uint32_t frames);
+
+  uint32_t m_sampleRate;
+  uint32_t m_channels;
+  uint32_t m_blockAlign;       // bytes per block, all channels
+  uint32_t m_samplesPerBlock;  // frames per block, including the one stored in each block header
+
+  std::unique_ptr<uint8_t[]> m_blocks;
+  size_t m_blockCount;
+  std::atomic<uint64_t> m_blocksWritten{ 0 };
+
+  // Writer-only state: PCM staged for the block in progress, and the encoder's running state.
+  std::unique_ptr<int16_t[]> m_staging;
+  uint32_t m_stagedFrames = 0;
+  bool m_stagedSilence = true; // nothing but silence staged, so the block needs no encoding
+  std::unique_ptr<int32_t[]> m_predictor;
+  std::unique_ptr<int32_t[]> m_stepIndex;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <new>
+
+//
+//  RouteArena
+//
+//  A single block per route, carved up into the intermediate buffers the audio path needs.
+//  It is sized and allocated when the capture stream is initialized (from the capture and render
+//  buffer sizes), so the audio thread itself never touches the heap.
+//
+class RouteArena {
+public:
+  static const size_t kAlignment = 64; // cache line
+
+  static size_t AlignedSize(size_t bytes) { return (bytes + kAlignment - 1) & ~(kAlignment - 1); }
+
+  // Frees any previous block (invalidating everything handed out from it) and allocates a new,
+  // zeroed one. Returns false if the allocation failed. Not for use on the audio thread.
+  bool Reset(size_t capacityBytes) {
+    m_storage.reset(new (std::nothrow) uint8_t[capacityBytes + kAlignment]());
+    m_base = nullptr;
+    m_capacity = 0;
+    m_used = 0;
+    if (!m_storage)
+      return false;
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(m_storage.get());
+    m_base = reinterpret_cast<uint8_t*>((base + kAlignment - 1) & ~(uintptr_t) (kAlignment - 1));
+    m_capacity = capacityBytes;
+    return true;
+  }
+
+  // Carves count elements out of the block. Returns nullptr if the arena was sized too small.
+  template <typename T> T* Allocate(size_t count) {
+    size_t bytes = AlignedSize(count * sizeof(T));
+    if (m_base == nullptr || bytes > m_capacity - m_used)
+      return nullptr;
+    T* result = reinterpret_cast<T*>(m_base + m_used);
+    m_used += bytes;
+    return result;
+  }
+
+  size_t Capacity() const { return m_capacity; }
+  size_t Used() const { return m_used; }
+
+private:
+  std::unique_ptr<uint8_t[]> m_storage;
+  uint8_t* m_base = nullptr;
+  size_t m_capacity = 0;
+  size_t m_used = 0;
+};
@@ -0,0 +1,94 @@
+#include "RoutePipeline.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "PacketTrace.h"
+
+RenderStatus RoutePipeline::Process(const RouteWakeup& wakeup, const RoutePacket& packet) {
+  bool silent = (packet.flags & PACKET_TRACE_FLAG_SILENT) != 0;
+  if (packet.flags & PACKET_TRACE_FLAG_DATA_DISCONTINUITY) {
+    m_stats.captureDiscontinuities.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint32_t sampleCount = packet.frames * wakeup.channels;
+
+  // DSP stages write into the arena's process buffer; untouched blocks pass straight through.
+  // Gain always runs, whatever the CPU pressure.
+  const uint8_t* blockData = packet.data;
+  if (!silent && wakeup.gain != 1.0f && wakeup.isFloat && packet.frames <= wakeup.processBufferFrames) {
+    const float* src = reinterpret_cast<const float*>(packet.data);
+    for (uint32_t i = 0; i < sampleCount; ++i) {
+      wakeup.processBuffer[i] = src[i] * wakeup.gain;
+    }
+    blockData = reinterpret_cast<const uint8_t*>(wakeup.processBuffer);
+  }
+
+  // Metering is the first optional work to go.
+  if (!silent && wakeup.qosLevel < QosLevel::NoMetering && wakeup.isFloat) {
+    const float* samples = reinterpret_cast<const float*>(blockData);
+    float blockPeak = 0.0f;
+    for (uint32_t i = 0; i < sampleCount; ++i) {
+      float magnitude = fabsf(samples[i]);
+      blockPeak = (magnitude > blockPeak) ? magnitude : blockPeak;
+    }
+    uint32_t blockPeakBits;
+    memcpy(&blockPeakBits, &blockPeak, sizeof(blockPeakBits));
+    if (blockPeakBits > m_peakBits.load(std::memory_order_relaxed)) {
+      m_peakBits.store(blockPeakBits, std::memory_order_relaxed);
+    }
+  }
+
+  // The replay history only follows the route while it's still at the format it was started with.
+  // Under pressure it records silence, which costs next to nothing and keeps it in step with the
+  // route.
+  ReplayBuffer* replay = wakeup.replay;
+  if (replay && wakeup.isFloat && replay->SampleRate() == wakeup.sampleRate && replay->Channels() == wakeup.channels) {
+    uint64_t blocksBefore = replay->BlocksEncoded();
+    uint64_t encodeStart = m_cycleCounter ? m_cycleCounter() : 0;
+    if (silent || wakeup.qosLevel >= QosLevel::NoHistory) {
+      replay->AppendSilence(packet.frames);
+    } else {
+      replay->Append(reinterpret_cast<const float*>(blockData), packet.frames);
+    }
+    if (m_cycleCounter) {
+      m_stats.replayEncodeCycles.fetch_add(m_cycleCounter() - encodeStart, std::memory_order_relaxed);
+    }
+    m_stats.replayBlocksEncoded.fetch_add(replay->BlocksEncoded() - blocksBefore, std::memory_order_relaxed);
+  }
+
+  if (wakeup.stream) {
+    wakeup.stream->Append(blockData, packet.frames, packet.qpcPosition, silent);
+    return RenderStatus::Ok;
+  }
+  if (!wakeup.render) {
+    return RenderStatus::Ok;
+  }
+
+  // A full render queue just drops this packet; a failure is for the caller to act on.
+  uint8_t* outputBuffer = nullptr;
+  RenderStatus status = wakeup.render->GetBuffer(packet.frames, &outputBuffer);
+  if (status != RenderStatus::Ok) {
+    if (status == RenderStatus::Full) {
+      m_stats.renderOverflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    return status;
+  }
+  if (!silent) {
+    if (wakeup.exclusive && wakeup.qosLevel < QosLevel::FastConversion) {
+      ConvertFloatToPcmDithered(reinterpret_cast<const float*>(blockData), outputBuffer, packet.frames * wakeup.renderFormat.channels, wakeup.renderFormat.sampleType, m_ditherState);
+    } else if (wakeup.exclusive) {
+      ConvertFloatToPcm(reinterpret_cast<const float*>(blockData), outputBuffer, packet.frames * wakeup.renderFormat.channels, wakeup.renderFormat.sampleType);
+    } else {
+      memcpy(outputBuffer, blockData, packet.frames * wakeup.blockAlign);
+    }
+  }
+  wakeup.render->ReleaseBuffer(packet.frames, silent);
+  return RenderStatus::Ok;
+}
+
+float RoutePipeline::TakePeak() {
+  uint32_t peakBits = m_peakBits.exchange(0, std::memory_order_relaxed);
+  float peak;
+  memcpy(&peak, &peakBits, sizeof(peak));
+  return peak;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include "ExclusiveFormat.h"
+#include "QosPolicy.h"
+#include "ReplayBuffer.h"
+#include "RouteStats.h"
+
+// The per-packet routing step, free of WASAPI types so a packet trace can be replayed through the
+// exact code the router runs. CLoopbackCapture feeds it from the capture client and renders through
+// an adapter over IAudioRenderClient; ReplayPacketTrace() feeds it recorded packets and renders into
+// a simulated queue.
+
+enum class RenderStatus {
+  Ok,
+  Full,   // the packet doesn't fit in the render queue right now; it is dropped
+  Failed, // the render device has gone away
+};
+
+// The local render queue, with IAudioRenderClient's contract: GetBuffer() hands out room for exactly
+// `frames` frames or fails, and ReleaseBuffer() queues them.
+class RenderTarget {
+public:
+  virtual RenderStatus GetBuffer(uint32_t frames, uint8_t** buffer) = 0;
+  virtual void ReleaseBuffer(uint32_t frames, bool silent) = 0;
+
+protected:
+  ~RenderTarget() {}
+};
+
+// A network stream, which takes every packet.
+class StreamTarget {
+public:
+  virtual void Append(const uint8_t* data, uint32_t frameCount, uint64_t qpcPosition, bool silent) = 0;
+
+protected:
+  ~StreamTarget() {}
+};
+
+// One captured packet, as returned by IAudioCaptureClient::GetBuffer.
+struct RoutePacket {
+  const uint8_t* data = nullptr;
+  uint32_t frames = 0;
+  uint32_t flags = 0; // PACKET_TRACE_FLAG_*, which match AUDCLNT_BUFFERFLAGS_*
+  uint64_t qpcPosition = 0;
+};
+
+// Everything a wakeup's packets go through and where they end up. The caller gathers it under the
+// route lock at the start of each wakeup.
+struct RouteWakeup {
+  // Capture format.
+  uint32_t sampleRate = 0;
+  uint32_t channels = 0;
+  uint32_t blockAlign = 0;
+  bool isFloat = false;
+  // Scratch space for DSP output, from the route's arena.
+  float* processBuffer = nullptr;
+  uint32_t processBufferFrames = 0;
+
+  float gain = 1.0f;
+  QosLevel qosLevel = QosLevel::Full;
+  ReplayBuffer* replay = nullptr;
+
+  // Packets go to the stream if there is one, otherwise to the render queue, otherwise nowhere
+  // (while the render side is down).
+  StreamTarget* stream = nullptr;
+  RenderTarget* render = nullptr;
+  // Exclusive-mode output: captured floats are converted to the format the device negotiated.
+  bool exclusive = false;
+  PcmFormat renderFormat;
+};
+
+//
+//  RoutePipeline
+//
+//  Applies gain, meters, feeds the replay history and hands each packet to its output. Counts
+//  capture discontinuities, render overflows and replay encoding cost in the route's stats. Audio
+//  thread only, apart from TakePeak().
+//
+class RoutePipeline {
+public:
+  // Returns the calling thread's CPU cycle count, for charging the replay encoder's cost.
+  typedef uint64_t (*CycleCounter)();
+
+  explicit RoutePipeline(RouteStats& stats, CycleCounter cycleCounter = nullptr) : m_stats(stats), m_cycleCounter(cycleCounter) {}
+
+  // Routes one packet. Returns the render queue's answer, or Ok if the packet didn't go to it.
+  RenderStatus Process(const RouteWakeup& wakeup, const RoutePacket& packet);
+
+  // Loudest sample since the last call. Any thread.
+  float TakePeak();
+
+private:
+  RouteStats& m_stats;
+  CycleCounter m_cycleCounter;
+  uint32_t m_ditherState = 1;
+  // Loudest sample since TakePeak() was last called, as the bit pattern of a non-negative float
+  // (which orders the same as the float itself).
+  std::atomic<uint32_t> m_peakBits{ 0 };
+};
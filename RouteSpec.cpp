@@ -0,0 +1,80 @@
+#include "RouteSpec.h"
+
+#include <wchar.h>
+
+bool ParseRouteSource(const wchar_t* specifier, uint32_t hostProcessId, RouteSource& out) {
+  out = RouteSource();
+
+  if (specifier == nullptr || *specifier == 0)
+    return false;
+
+  if (!wcscmp(specifier, L"*")) {
+    out.mode = RouteSource::Mode::ExcludeProcessTree;
+    out.pid = hostProcessId;
+    return true;
+  }
+
+  wchar_t* endptr = nullptr;
+  unsigned long pid = wcstoul(specifier, &endptr, 10);
+  if (*endptr == 0 && pid != 0) {
+    out.pid = static_cast<uint32_t>(pid);
+  } else { // conversion failed, treat it as an image name
+    out.imageName = specifier;
+  }
+  return true;
+}
+
+void SplitControlCommand(const std::wstring& command, std::wstring& verb, std::wstring& argument) {
+  size_t split = command.find(L' ');
+  verb = command.substr(0, split);
+  argument.clear();
+  if (split != std::wstring::npos) {
+    size_t argumentStart = command.find_first_not_of(L' ', split);
+    if (argumentStart != std::wstring::npos)
+      argument = command.substr(argumentStart);
+  }
+}
+
+bool ParseGainDb(const std::wstring& argument, float& gainDb) {
+  wchar_t* endptr = nullptr;
+  double value = wcstod(argument.c_str(), &endptr);
+  if (argument.empty() || *endptr != 0 || value < -96.0 || value > 24.0)
+    return false;
+  gainDb = (float) value;
+  return true;
+}
+
+bool ParseRenderBufferMs(const std::wstring& argument, uint32_t& bufferMs) {
+  wchar_t* endptr = nullptr;
+  unsigned long value = wcstoul(argument.c_str(), &endptr, 10);
+  if (argument.empty() || *endptr != 0 || value < 1 || value > 2000)
+    return false;
+  bufferMs = (uint32_t) value;
+  return true;
+}
+
+bool ParseStreamDestination(const std::wstring& destination, std::wstring& host, std::wstring& port) {
+  size_t hostStart = 0, hostEnd = 0;
+  if (!destination.empty() && destination[0] == L'[') {
+    hostStart = 1;
+    hostEnd = destination.find(L']');
+    if (hostEnd == std::wstring::npos || destination.compare(hostEnd, 2, L"]:") != 0)
+      return false;
+  } else {
+    hostEnd = destination.find(L':');
+    if (hostEnd == std::wstring::npos || destination.find(L':', hostEnd + 1) != std::wstring::npos)
+      return false;
+  }
+  size_t portStart = hostEnd + (hostStart ? 2 : 1);
+  if (hostEnd == hostStart || portStart >= destination.size())
+    return false;
+
+  std::wstring portText = destination.substr(portStart);
+  wchar_t* endptr = nullptr;
+  unsigned long value = wcstoul(portText.c_str(), &endptr, 10);
+  if (*endptr != 0 || portText[0] < L'0' || portText[0] > L'9' || value < 1 || value > 65535)
+    return false;
+  host = destination.substr(hostStart, hostEnd - hostStart);
+  port = portText;
+  return true;
+}
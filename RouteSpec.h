@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// Describes which audio a route captures. This is deliberately free of WASAPI types so the
+// specifier parsing and loopback mode selection can be exercised without an audio stack.
+struct RouteSource {
+  enum class Mode {
+    // Capture only the audio rendered by the source process tree.
+    IncludeProcessTree,
+    // Capture everything rendered on the system except the excluded process tree. One engine
+    // stream covers any number of applications, so stream and callback counts stay constant.
+    ExcludeProcessTree,
+  };
+
+  Mode mode = Mode::IncludeProcessTree;
+  uint32_t pid = 0; // Target (or excluded) PID. 0 if the source is matched by image name.
+  std::wstring imageName; // Empty if the source was given as a PID.
+
+  bool matchesByName() const { return pid == 0; }
+};
+
+// Parses a source specifier:
+//   "1234"        - include the process tree rooted at PID 1234
+//   "vlc.exe"     - include the process tree of the first process with this image name
+//   "*"           - exclude mode: everything except the host (injection target) process tree.
+//                   Excluding the host also keeps our own rendered output out of the capture.
+// Returns false if the specifier is empty.
+bool ParseRouteSource(const wchar_t* specifier, uint32_t hostProcessId, RouteSource& out);
+
+// How much latency a route can tolerate. Interactive routes wake on every engine period; relaxed
+// routes (background recording, streaming to another room) drain larger batches on a coarse timer
+// behind a deeper render queue, for far fewer wakeups.
+enum class LatencyClass { Interactive, Relaxed };
+
+// Timing of relaxed routes. The wakeup timer may be coalesced up to the tolerance late, so the
+// render queue starts with that much silence and has room for it plus a whole batch.
+const uint32_t kRelaxedWakeupMs = 100;
+const uint32_t kRelaxedWakeupToleranceMs = 20;
+const uint32_t kRelaxedCaptureBufferMs = 500;
+const uint32_t kRelaxedRenderBufferMs = 300;
+const uint32_t kRelaxedPreRollMs = kRelaxedWakeupMs + kRelaxedWakeupToleranceMs;
+
+// Describes where a route plays its audio.
+struct RouteOutput {
+  std::wstring deviceName; // Friendly name of the render endpoint. Empty picks the first non-default endpoint.
+  uint32_t renderBufferMs = 100;
+  std::wstring streamDestination; // "host:port" or "[IPv6 address]:port" to stream RTP/UDP instead of playing to the render device.
+  bool exclusive = false; // Open the render device in exclusive mode, if it will negotiate a format.
+  LatencyClass latency = LatencyClass::Interactive;
+};
+
+// Splits a control command into its verb and argument, at the first space. Extra spaces before the
+// argument are skipped; the argument is empty if there is none.
+void SplitControlCommand(const std::wstring& command, std::wstring& verb, std::wstring& argument);
+
+// Arguments of the commands that retune a running route. Each returns false, leaving the output
+// untouched, if the argument isn't a number in range.
+bool ParseGainDb(const std::wstring& argument, float& gainDb);               // -96 to 24 dB
+bool ParseRenderBufferMs(const std::wstring& argument, uint32_t& bufferMs);  // 1 to 2000 ms
+
+// Splits a stream destination into host and port: "host:port", or "[address]:port" for an IPv6
+// address, whose own colons would otherwise be taken for the port separator. The port must be a
+// number from 1 to 65535. Returns false, leaving the outputs untouched, for anything else,
+// including an IPv6 address without brackets.
+bool ParseStreamDestination(const std::wstring& destination, std::wstring& host, std::wstring& port);
@@ -0,0 +1,45 @@
+#include "RouteStats.h"
+
+#include <sstream>
+
+std::wstring StatsHistogram::Format() const {
+  std::wstringstream ss;
+  ss << L"{";
+  bool first = true;
+  for (int bucket = 0; bucket < kBuckets; ++bucket) {
+    uint64_t count = Count(bucket);
+    if (count == 0)
+      continue;
+    if (!first)
+      ss << L" ";
+    ss << BucketLowerBound(bucket) << L":" << count;
+    first = false;
+  }
+  ss << L"}";
+  return ss.str();
+}
+
+std::wstring RouteStats::Format() const {
+  uint64_t callbackCount = callbacks.load(std::memory_order_relaxed);
+  uint64_t cycles = totalCallbackCycles.load(std::memory_order_relaxed);
+  uint64_t replayBlocks = replayBlocksEncoded.load(std::memory_order_relaxed);
+
+  std::wstringstream ss;
+  ss << L"callbacks=" << callbackCount
+     << L" meanCycles=" << (callbackCount ? cycles / callbackCount : 0)
+     << L" deadlineMisses=" << deadlineMisses.load(std::memory_order_relaxed)
+     << L" captureDiscontinuities=" << captureDiscontinuities.load(std::memory_order_relaxed)
+     << L" renderOverflows=" << renderOverflows.load(std::memory_order_relaxed)
+     << L" qosLevel=" << qosLevel.load(std::memory_order_relaxed)
+     << L" qosSheds=" << qosSheds.load(std::memory_order_relaxed)
+     << L" audioThreadAllocations=" << audioThreadAllocations.load(std::memory_order_relaxed)
+     << L" cycles=" << callbackCycles.Format()
+     << L" deadlineUsagePercent=" << deadlineUsagePercent.Format()
+     << L" captureRecoveries=" << captureRecoveries.load(std::memory_order_relaxed)
+     << L" renderRecoveries=" << renderRecoveries.load(std::memory_order_relaxed)
+     << L" failedRecoveries=" << failedRecoveries.load(std::memory_order_relaxed)
+     << L" lastRecoveryMs=" << lastRecoveryMs.load(std::memory_order_relaxed)
+     << L" recoveryMs=" << recoveryMs.Format()
+     << L" replayCyclesPerBlock=" << (replayBlocks ? replayEncodeCycles.load(std::memory_order_relaxed) / replayBlocks : 0);
+  return ss.str();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+//
+//  StatsHistogram
+//
+//  Fixed-size histogram that the audio thread can update without locks or allocation, and that
+//  any other thread can read. Buckets are either linear (bucketWidth > 0) or powers of two
+//  (bucketWidth == 0). Values past the last bucket are counted in the last bucket.
+//
+class StatsHistogram {
+public:
+  static const int kBuckets = 32;
+
+  explicit StatsHistogram(uint64_t bucketWidth) : m_bucketWidth(bucketWidth) {
+    Reset();
+  }
+
+  void Record(uint64_t value) {
+    int bucket;
+    if (m_bucketWidth != 0) {
+      uint64_t linearBucket = value / m_bucketWidth;
+      bucket = (linearBucket < kBuckets) ? (int) linearBucket : kBuckets - 1;
+    } else {
+      bucket = 0;
+      while (value > 1 && bucket < kBuckets - 1) {
+        value >>= 1;
+        bucket++;
+      }
+    }
+    m_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t Count(int bucket) const { return m_counts[bucket].load(std::memory_order_relaxed); }
+
+  // Smallest value that lands in this bucket.
+  uint64_t BucketLowerBound(int bucket) const {
+    return (m_bucketWidth != 0) ? bucket * m_bucketWidth : (bucket == 0 ? 0 : (1ULL << bucket));
+  }
+
+  void Reset() {
+    for (int bucket = 0; bucket < kBuckets; ++bucket)
+      m_counts[bucket].store(0, std::memory_order_relaxed);
+  }
+
+  // Nonzero buckets as "lowerBound:count" pairs, e.g. "{16384:120 32768:4}".
+  std::wstring Format() const;
+
+private:
+  uint64_t m_bucketWidth;
+  std::atomic<uint64_t> m_counts[kBuckets];
+};
+
+//
+//  RouteStats
+//
+//  Per-route cost accounting, written by the capture callback and read by the control channel.
+//
+struct RouteStats {
+  // CPU cycles the capture callback spent per invocation (thread cycle time, so time spent
+  // preempted by the host process doesn't count against us).
+  StatsHistogram callbackCycles{ 0 };
+
+  // How much of the deadline had elapsed between the engine finishing capturing the oldest packet
+  // of a wakeup (the end of its last frame, the earliest it could have been delivered) and the
+  // callback finishing with it, in percent. Measuring from the packet's first frame would charge
+  // every callback a full packet length it could do nothing about. Anything at or over 100% missed
+  // the deadline: the render side has had to cover for us.
+  StatsHistogram deadlineUsagePercent{ 10 };
+
+  std::atomic<uint64_t> callbacks{ 0 };
+  std::atomic<uint64_t> totalCallbackCycles{ 0 };
+  std::atomic<uint64_t> deadlineMisses{ 0 };
+  // Heap allocations made on the audio thread inside the callback. Only counted in builds with
+  // AUDIOROUTER_COUNT_ALLOCATIONS; must stay at zero.
+  std::atomic<uint64_t> audioThreadAllocations{ 0 };
+
+  // Watchdog rebuilds, by the side that failed, and how long each outage lasted from the last good
+  // wakeup (or the render failure) to the rebuilt side running again, in 10 ms buckets.
+  std::atomic<uint64_t> captureRecoveries{ 0 };
+  std::atomic<uint64_t> renderRecoveries{ 0 };
+  std::atomic<uint64_t> failedRecoveries{ 0 };
+  std::atomic<uint64_t> lastRecoveryMs{ 0 };
+  StatsHistogram recoveryMs{ 10 };
+
+  // Graceful degradation: the current QosLevel, how many times a level was shed, and the glitches
+  // it is there to prevent, besides deadline misses: gaps the capture engine reported and packets
+  // dropped because the render queue was full.
+  std::atomic<uint32_t> qosLevel{ 0 };
+  std::atomic<uint64_t> qosSheds{ 0 };
+  std::atomic<uint64_t> captureDiscontinuities{ 0 };
+  std::atomic<uint64_t> renderOverflows{ 0 };
+
+  // Audio-thread cost of keeping the instant-replay history.
+  std::atomic<uint64_t> replayEncodeCycles{ 0 };
+  std::atomic<uint64_t> replayBlocksEncoded{ 0 };
+
+  void Reset() {
+    callbackCycles.Reset();
+    deadlineUsagePercent.Reset();
+    callbacks.store(0, std::memory_order_relaxed);
+    totalCallbackCycles.store(0, std::memory_order_relaxed);
+    deadlineMisses.store(0, std::memory_order_relaxed);
+    audioThreadAllocations.store(0, std::memory_order_relaxed);
+    captureRecoveries.store(0, std::memory_order_relaxed);
+    renderRecoveries.store(0, std::memory_order_relaxed);
+    failedRecoveries.store(0, std::memory_order_relaxed);
+    lastRecoveryMs.store(0, std::memory_order_relaxed);
+    recoveryMs.Reset();
+    qosSheds.store(0, std::memory_order_relaxed);
+    captureDiscontinuities.store(0, std::memory_order_relaxed);
+    renderOverflows.store(0, std::memory_order_relaxed);
+    replayEncodeCycles.store(0, std::memory_order_relaxed);
+    replayBlocksEncoded.store(0, std::memory_order_relaxed);
+  }
+
+  std::wstring Format() const;
+};
@@ -0,0 +1,59 @@
+#include "RouteWatchdog.h"
+
+void RouteWatchdog::NoteRenderFault() {
+  if (!m_renderFaulted.load(std::memory_order_relaxed)) {
+    m_renderFaultTime.store(m_clock(), std::memory_order_relaxed);
+    m_renderFaulted.store(true, std::memory_order_release);
+  }
+}
+
+WatchdogCheck RouteWatchdog::Check(WatchdogBackend& backend) {
+  WatchdogCheck result;
+  uint64_t now = m_clock();
+  if (now < m_nextAttempt)
+    return result;
+
+  uint64_t lastWakeup = m_lastWakeup.load(std::memory_order_relaxed);
+  result.captureFailed = backend.CaptureFailed();
+  if (!result.captureFailed && now > lastWakeup && now - lastWakeup > StallThreshold())
+    result.captureFailed = backend.CaptureHasQueuedData();
+  result.renderFailed = RenderFaulted();
+  if (!result.captureFailed && !result.renderFailed)
+    return result;
+
+  uint64_t outageStart = result.captureFailed ? lastWakeup : m_renderFaultTime.load(std::memory_order_relaxed);
+  bool rebuilt = true;
+  if (result.renderFailed) {
+    RebuildStatus status = backend.RebuildRender();
+    rebuilt = (status != RebuildStatus::Failed);
+    // The new device can't be used until capture follows it to the new format.
+    result.captureFailed = result.captureFailed || (status == RebuildStatus::FormatChanged);
+    if (status == RebuildStatus::Ok)
+      ClearRenderFault();
+    if (rebuilt)
+      m_stats.renderRecoveries.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (rebuilt && result.captureFailed) {
+    rebuilt = backend.RebuildCapture();
+    if (rebuilt) {
+      ClearRenderFault();
+      m_stats.captureRecoveries.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t finished = m_clock();
+  result.recovered = rebuilt;
+  result.rebuildMs = (finished - now) / 10000;
+  if (rebuilt) {
+    if (result.captureFailed)
+      m_lastWakeup.store(finished, std::memory_order_relaxed); // the new stream's clock starts now
+    result.outageMs = (finished - ((outageStart < now) ? outageStart : now)) / 10000;
+    m_stats.recoveryMs.Record(result.outageMs);
+    m_stats.lastRecoveryMs.store(result.outageMs, std::memory_order_relaxed);
+  } else {
+    // Device gone or busy; don't hammer it every check.
+    m_stats.failedRecoveries.fetch_add(1, std::memory_order_relaxed);
+    m_nextAttempt = finished + kRetryDelay;
+  }
+  return result;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include "RouteStats.h"
+
+// How rebuilding the render side went. FormatChanged: the new device is running but wants a
+// different mix format, so capture has to be rebuilt to match before it can be used.
+enum class RebuildStatus { Ok, FormatChanged, Failed };
+
+// What the watchdog asks of a route, and the rebuilds it can order. CLoopbackCapture implements it
+// over WASAPI; the tests implement it over a fake device. Router thread only.
+class WatchdogBackend {
+public:
+  // The capture client gave up (its callback failed).
+  virtual bool CaptureFailed() = 0;
+  // Asked once capture hasn't woken up for longer than the stall threshold: true if the capture
+  // side is running and the engine has data queued for it (or can't tell), false if the source
+  // has simply gone quiet.
+  virtual bool CaptureHasQueuedData() = 0;
+  // Reopens the output device while capture keeps running.
+  virtual RebuildStatus RebuildRender() = 0;
+  // Reactivates the capture stream, installing a render side that RebuildRender() left waiting on
+  // a format change, if there is one.
+  virtual bool RebuildCapture() = 0;
+
+protected:
+  ~WatchdogBackend() {}
+};
+
+// What a watchdog check found and did, for logging.
+struct WatchdogCheck {
+  bool captureFailed = false;
+  bool renderFailed = false;
+  bool recovered = false;
+  uint64_t rebuildMs = 0; // time spent rebuilding
+  uint64_t outageMs = 0;  // from the last good wakeup (or the render failure) to running again
+};
+
+//
+//  RouteWatchdog
+//
+//  Decides when a route has failed and which side to rebuild. The capture side has failed if its
+//  client gave up, or if wakeups have stopped for longer than the stall threshold while the engine
+//  still has data queued; a source that isn't playing can legitimately go quiet. The render side
+//  has failed if the audio thread flagged it. Only the failed side is rebuilt, so a render device
+//  reset doesn't reactivate the loopback stream and vice versa. A rebuild that fails is retried
+//  after kRetryDelay rather than on every check.
+//
+//  The stall threshold is one wakeup period plus its timer tolerance plus kStallMargin: 30 ms for
+//  an interactive route on a 10 ms engine, which with a check every kCheckIntervalMs recovers well
+//  inside 100 ms. A relaxed route's timer may legitimately fire kRelaxedWakeupMs +
+//  kRelaxedWakeupToleranceMs apart, so its stalls can't be told from a late timer for 140 ms; its
+//  pre-roll covers most of that.
+//
+//  Times are in 100ns units, from the clock given at construction. The audio thread calls
+//  NoteWakeup() and NoteRenderFault(); everything else is the router thread's.
+//
+class RouteWatchdog {
+public:
+  typedef uint64_t (*Clock)();
+
+  static const uint32_t kCheckIntervalMs = 10;
+  static const uint64_t kStallMargin = 200000;  // 20 ms
+  static const uint64_t kRetryDelay = 5000000;  // 500 ms
+
+  RouteWatchdog(RouteStats& stats, Clock clock) : m_stats(stats), m_clock(clock) {}
+
+  // How often the capture side wakes up, and how late its timer may fire. Set whenever the capture
+  // client is initialized.
+  void SetWakeupPeriod(uint64_t period, uint64_t tolerance) {
+    m_stallThreshold.store(period + tolerance + kStallMargin, std::memory_order_relaxed);
+  }
+  uint64_t StallThreshold() const { return m_stallThreshold.load(std::memory_order_relaxed); }
+
+  // Audio thread: stamps a capture wakeup, or flags the render side as failed.
+  void NoteWakeup() { m_lastWakeup.store(m_clock(), std::memory_order_relaxed); }
+  void NoteRenderFault();
+  bool RenderFaulted() const { return m_renderFaulted.load(std::memory_order_acquire); }
+  // The render side was replaced outside the watchdog (a retune, a restart).
+  void ClearRenderFault() { m_renderFaulted.store(false, std::memory_order_release); }
+
+  // Called every kCheckIntervalMs while the route is running.
+  WatchdogCheck Check(WatchdogBackend& backend);
+
+private:
+  RouteStats& m_stats;
+  Clock m_clock;
+  std::atomic<uint64_t> m_stallThreshold{ 300000 };
+  std::atomic<uint64_t> m_lastWakeup{ 0 };
+  std::atomic<bool> m_renderFaulted{ false };
+  std::atomic<uint64_t> m_renderFaultTime{ 0 };
+  uint64_t m_nextAttempt = 0;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RTP (RFC 3550) fixed header handling shared by the router's network sink and the receiver.
+// Audio is carried as L16 (RFC 3551): interleaved, big-endian, signed 16-bit samples. Channel count
+// and sample rate are not carried in-band, so the receiver has to be told what the sender uses.
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+#define RTP_PAYLOAD_TYPE_L16 96 // dynamic payload type
+
+// Keeps each datagram under a typical Ethernet MTU once IP and UDP headers are added.
+#define RTP_MAX_PAYLOAD_SIZE 1280
+
+struct RtpHeader {
+  bool marker = false;
+  uint8_t payloadType = RTP_PAYLOAD_TYPE_L16;
+  uint16_t sequence = 0;
+  uint32_t timestamp = 0; // In sample frames
+  uint32_t ssrc = 0;
+};
+
+inline void WriteRtpHeader(uint8_t* dst, const RtpHeader& header) {
+  dst[0] = RTP_VERSION << 6;
+  dst[1] = (uint8_t) ((header.marker ? 0x80 : 0) | (header.payloadType & 0x7f));
+  dst[2] = (uint8_t) (header.sequence >> 8);
+  dst[3] = (uint8_t) (header.sequence);
+  dst[4] = (uint8_t) (header.timestamp >> 24);
+  dst[5] = (uint8_t) (header.timestamp >> 16);
+  dst[6] = (uint8_t) (header.timestamp >> 8);
+  dst[7] = (uint8_t) (header.timestamp);
+  dst[8] = (uint8_t) (header.ssrc >> 24);
+  dst[9] = (uint8_t) (header.ssrc >> 16);
+  dst[10] = (uint8_t) (header.ssrc >> 8);
+  dst[11] = (uint8_t) (header.ssrc);
+}
+
+// Parses the fixed header, skipping any CSRC list and header extension, and strips padding.
+// Returns false if the datagram is not a well-formed RTP packet.
+inline bool ParseRtpHeader(const uint8_t* src, size_t size, RtpHeader& header, size_t& payloadOffset, size_t& payloadSize) {
+  if (size < RTP_HEADER_SIZE || (src[0] >> 6) != RTP_VERSION)
+    return false;
+
+  header.marker = (src[1] & 0x80) != 0;
+  header.payloadType = src[1] & 0x7f;
+  header.sequence = (uint16_t) ((src[2] << 8) | src[3]);
+  header.timestamp = ((uint32_t) src[4] << 24) | ((uint32_t) src[5] << 16) | ((uint32_t) src[6] << 8) | src[7];
+  header.ssrc = ((uint32_t) src[8] << 24) | ((uint32_t) src[9] << 16) | ((uint32_t) src[10] << 8) | src[11];
+
+  size_t offset = RTP_HEADER_SIZE + (src[0] & 0x0f) * 4; // CSRC list
+  if (src[0] & 0x10) { // header extension
+    if (size < offset + 4)
+      return false;
+    offset += 4 + (((size_t) src[offset + 2] << 8) | src[offset + 3]) * 4;
+  }
+  size_t end = size;
+  if (src[0] & 0x20) { // padding
+    if (src[size - 1] > size)
+      return false;
+    end -= src[size - 1];
+  }
+  if (offset > end)
+    return false;
+
+  payloadOffset = offset;
+  payloadSize = end - offset;
+  return true;
+}
+
+// L16 payload packing. Float samples are scaled by 32767 and clamped; 16-bit PCM is only byte-swapped.
+inline void FloatToL16(const float* src, uint8_t* dst, size_t sampleCount) {
+  for (size_t i = 0; i < sampleCount; ++i) {
+    float sample = src[i] * 32767.0f;
+    sample = (sample > 32767.0f) ? 32767.0f : ((sample < -32768.0f) ? -32768.0f : sample);
+    int16_t value = (int16_t) sample;
+    dst[i * 2] = (uint8_t) (value >> 8);
+    dst[i * 2 + 1] = (uint8_t) value;
+  }
+}
+
+inline void Int16ToL16(const int16_t* src, uint8_t* dst, size_t sampleCount) {
+  for (size_t i = 0; i < sampleCount; ++i) {
+    int16_t value = src[i];
+    dst[i * 2] = (uint8_t) (value >> 8);
+    dst[i * 2 + 1] = (uint8_t) value;
+  }
+}
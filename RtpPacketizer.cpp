@@ -0,0 +1,73 @@
+#include "RtpPacketizer.h"
+
+#include <string.h>
+
+bool RtpPacketizer::Reset(uint32_t channels, uint32_t sampleRate, bool sourceIsFloat, uint16_t firstSequence, uint32_t ssrc) {
+  m_sourceIsFloat = sourceIsFloat;
+  m_channels = channels;
+  m_sampleRate = sampleRate;
+  m_maxPacketFrames = (channels == 0) ? 0 : RTP_MAX_PAYLOAD_SIZE / (channels * (uint32_t) sizeof(int16_t));
+  if (m_maxPacketFrames == 0 || sampleRate == 0)
+    return false;
+
+  m_packet.resize(RTP_HEADER_SIZE + m_maxPacketFrames * m_channels * sizeof(int16_t));
+  m_packetFrames = 0;
+  m_header = RtpHeader();
+  m_header.marker = true;
+  m_header.sequence = firstSequence;
+  m_header.ssrc = ssrc;
+  m_haveTimestamp = false;
+  return true;
+}
+
+void RtpPacketizer::Append(const uint8_t* data, uint32_t frameCount, uint64_t qpcPosition, bool silent) {
+  uint32_t qpcTimestamp = (uint32_t) ((qpcPosition * m_sampleRate) / 10000000ULL);
+  int32_t drift = (int32_t) (qpcTimestamp - m_nextTimestamp);
+  int32_t tolerance = (int32_t) (m_sampleRate / 1000);
+  if (!m_haveTimestamp || drift > tolerance || drift < -tolerance) {
+    Flush();
+    m_nextTimestamp = qpcTimestamp;
+    m_haveTimestamp = true;
+  }
+
+  uint32_t frameOffset = 0;
+  while (frameOffset < frameCount) {
+    if (m_packetFrames == 0) {
+      m_header.timestamp = m_nextTimestamp;
+    }
+
+    uint32_t framesToCopy = (frameCount - frameOffset < m_maxPacketFrames - m_packetFrames) ? frameCount - frameOffset : m_maxPacketFrames - m_packetFrames;
+    uint32_t sampleCount = framesToCopy * m_channels;
+    uint8_t* dst = m_packet.data() + RTP_HEADER_SIZE + m_packetFrames * m_channels * sizeof(int16_t);
+
+    if (silent) {
+      memset(dst, 0, sampleCount * sizeof(int16_t));
+    } else if (m_sourceIsFloat) {
+      FloatToL16(reinterpret_cast<const float*>(data) + frameOffset * m_channels, dst, sampleCount);
+    } else {
+      Int16ToL16(reinterpret_cast<const int16_t*>(data) + frameOffset * m_channels, dst, sampleCount);
+    }
+
+    m_packetFrames += framesToCopy;
+    m_nextTimestamp += framesToCopy;
+    frameOffset += framesToCopy;
+
+    if (m_packetFrames == m_maxPacketFrames) {
+      SendPacket();
+    }
+  }
+}
+
+void RtpPacketizer::Flush() {
+  if (m_packetFrames != 0) {
+    SendPacket();
+  }
+}
+
+void RtpPacketizer::SendPacket() {
+  WriteRtpHeader(m_packet.data(), m_header);
+  m_sender.SendPacket(m_packet.data(), (uint32_t) (RTP_HEADER_SIZE + m_packetFrames * m_channels * sizeof(int16_t)));
+  m_header.marker = false;
+  m_header.sequence++;
+  m_packetFrames = 0;
+}
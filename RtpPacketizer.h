@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "RoutePipeline.h"
+#include "Rtp.h"
+
+// Where finished datagrams go. CNetworkSink sends them on a UDP socket; the tests send them over
+// localhost or just inspect them. Called on the audio thread, so it must not block.
+class RtpPacketSender {
+public:
+  virtual void SendPacket(const uint8_t* packet, uint32_t size) = 0;
+
+protected:
+  ~RtpPacketSender() {}
+};
+
+//
+//  RtpPacketizer
+//
+//  Turns captured frames into RTP/L16 datagrams. Frames are accumulated into MTU-sized packets, so
+//  a wakeup costs one send per full packet plus one for the remainder at Flush(), regardless of how
+//  the audio engine split the capture into packets.
+//
+//  RTP timestamps are in sample frames, anchored to the engine's QPC position. They run on
+//  continuously as long as the positions agree with them to within a millisecond, so rounding in
+//  the QPC positions doesn't show up as gaps or overlaps at the receiver; beyond that (a glitch, a
+//  restart) the partial packet is sent and the stream is re-anchored.
+//
+class RtpPacketizer : public StreamTarget {
+public:
+  explicit RtpPacketizer(RtpPacketSender& sender) : m_sender(sender) {}
+
+  // Prepares a stream of the given format, starting at a new sequence number and SSRC with the
+  // marker bit set. sourceIsFloat: the frames are 32-bit float, otherwise 16-bit PCM. Returns false
+  // if not even one frame fits in a packet. Not for use on the audio thread.
+  bool Reset(uint32_t channels, uint32_t sampleRate, bool sourceIsFloat, uint16_t firstSequence, uint32_t ssrc);
+
+  // Audio thread: packetizes frames captured at qpcPosition (100ns units, as reported by
+  // IAudioCaptureClient::GetBuffer). Full packets are sent immediately.
+  void Append(const uint8_t* data, uint32_t frameCount, uint64_t qpcPosition, bool silent) override;
+
+  // Audio thread: sends any partially filled packet. Called once at the end of each wakeup.
+  void Flush();
+
+  uint32_t Channels() const { return m_channels; }
+  uint32_t SampleRate() const { return m_sampleRate; }
+  uint32_t MaxPacketFrames() const { return m_maxPacketFrames; }
+
+private:
+  void SendPacket();
+
+  RtpPacketSender& m_sender;
+  bool m_sourceIsFloat = false;
+  uint32_t m_channels = 0;
+  uint32_t m_sampleRate = 0;
+  uint32_t m_maxPacketFrames = 0;
+
+  std::vector<uint8_t> m_packet; // RTP header followed by up to m_maxPacketFrames of L16 payload
+  uint32_t m_packetFrames = 0;
+  RtpHeader m_header;
+  uint32_t m_nextTimestamp = 0;
+  bool m_haveTimestamp = false;
+};
@@ -0,0 +1,159 @@
+#include "TraceReplay.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "RouteArena.h"
+#include "RoutePipeline.h"
+
+namespace {
+
+// Render queue that fills as the pipeline queues packets and drains as the device plays them, like
+// the device's buffer.
+class SimulatedRenderQueue : public RenderTarget {
+public:
+  SimulatedRenderQueue(uint32_t capacityFrames, uint32_t blockAlign) : m_capacityFrames(capacityFrames), m_blockAlign(blockAlign) {}
+
+  void SetPadding(uint32_t frames) { m_queuedFrames = frames; }
+  uint32_t Padding() const { return m_queuedFrames; }
+  void Drain(uint64_t frames) { m_queuedFrames = (frames < m_queuedFrames) ? m_queuedFrames - (uint32_t) frames : 0; }
+
+  RenderStatus GetBuffer(uint32_t frames, uint8_t** buffer) override {
+    // IAudioRenderClient::GetBuffer fails if the request doesn't fit in the free space.
+    if ((uint64_t) m_queuedFrames + frames > m_capacityFrames)
+      return RenderStatus::Full;
+    if (m_buffer.size() < (size_t) frames * m_blockAlign)
+      m_buffer.resize((size_t) frames * m_blockAlign);
+    *buffer = m_buffer.data();
+    return RenderStatus::Ok;
+  }
+
+  void ReleaseBuffer(uint32_t frames, bool) override { m_queuedFrames += frames; }
+
+private:
+  uint32_t m_capacityFrames;
+  uint32_t m_blockAlign;
+  uint32_t m_queuedFrames = 0;
+  std::vector<uint8_t> m_buffer;
+};
+
+class SimulatedStream : public StreamTarget {
+public:
+  void Append(const uint8_t*, uint32_t frameCount, uint64_t, bool) override { m_frames += frameCount; }
+
+  uint64_t Frames() const { return m_frames; }
+
+private:
+  uint64_t m_frames = 0;
+};
+
+}
+
+void ReplayPacketTrace(PacketTraceReader& reader, PacketTraceReplayResult& result) {
+  result = PacketTraceReplayResult();
+
+  // The route as it was set up when the trace started: float capture, shared-mode render at the
+  // capture format, default gain. Traces don't record the audio, so a quiet tone stands in for it.
+  const PacketTraceFormat& format = reader.Format();
+  bool streamed = (format.renderBufferFrames == 0);
+  uint32_t channels = std::max(format.channels, 1u);
+  uint32_t blockAlign = channels * sizeof(float);
+
+  std::vector<float> captured;
+  RouteArena arena;
+  uint32_t processBufferFrames = std::max(format.captureBufferFrames, format.renderBufferFrames);
+  arena.Reset(RouteArena::AlignedSize((size_t) processBufferFrames * channels * sizeof(float)));
+
+  RouteStats stats;
+  RoutePipeline pipeline(stats);
+  SimulatedRenderQueue renderQueue(format.renderBufferFrames, blockAlign);
+  SimulatedStream stream;
+
+  RouteWakeup wakeup;
+  wakeup.sampleRate = format.sampleRate;
+  wakeup.channels = channels;
+  wakeup.blockAlign = blockAlign;
+  wakeup.isFloat = true;
+  wakeup.processBuffer = arena.Allocate<float>((size_t) processBufferFrames * channels);
+  wakeup.processBufferFrames = wakeup.processBuffer ? processBufferFrames : 0;
+  if (streamed) {
+    wakeup.stream = &stream;
+  } else {
+    wakeup.render = &renderQueue;
+  }
+
+  uint64_t lastWakeupQpc = 0;
+  uint64_t recordedQueued = 0; // the recorded route's render queue: its padding plus the packets that fit
+  uint64_t expectedDevicePosition = 0;
+  bool havePacket = false;
+
+  PacketTraceEvent event;
+  while (reader.Next(event)) {
+    if (event.type == PacketTraceEvent::Type::Wakeup) {
+      if (result.wakeups != 0) {
+        uint64_t intervalUs = (event.qpc - lastWakeupQpc) / 10;
+        if (intervalUs > result.maxWakeupIntervalUs)
+          result.maxWakeupIntervalUs = intervalUs;
+      }
+      if (!streamed && result.wakeups == 0) {
+        renderQueue.SetPadding(event.renderPadding);
+      } else if (!streamed) {
+        // The device played what the recorded route had queued less what it found left. A queue
+        // that ran dry says only that the device played all of it; it kept going for as long as
+        // the wakeup took.
+        uint64_t consumed = (recordedQueued > event.renderPadding) ? recordedQueued - event.renderPadding : 0;
+        if (event.renderPadding == 0)
+          consumed = std::max(consumed, (event.qpc - lastWakeupQpc) * format.sampleRate / 10000000);
+        renderQueue.Drain(consumed);
+        if (renderQueue.Padding() != event.renderPadding)
+          result.paddingMismatches++;
+      }
+      if (!streamed) {
+        if (result.frames != 0 && renderQueue.Padding() == 0)
+          result.renderUnderruns++;
+        if (renderQueue.Padding() < result.minRenderPadding)
+          result.minRenderPadding = renderQueue.Padding();
+        recordedQueued = event.renderPadding;
+      }
+
+      lastWakeupQpc = event.qpc;
+      result.wakeups++;
+
+    } else {
+      if (event.flags & PACKET_TRACE_FLAG_SILENT)
+        result.silentPackets++;
+      if (havePacket && event.devicePosition != expectedDevicePosition)
+        result.devicePositionGaps++;
+
+      size_t sampleCount = (size_t) event.frames * channels;
+      if (captured.size() < sampleCount) {
+        size_t first = captured.size();
+        captured.resize(sampleCount);
+        for (size_t i = first; i < sampleCount; ++i)
+          captured[i] = 0.1f * sinf((float) (i / channels) * 0.0576f); // about 440 Hz at 48 kHz
+      }
+
+      RoutePacket packet;
+      packet.data = reinterpret_cast<const uint8_t*>(captured.data());
+      packet.frames = event.frames;
+      packet.flags = event.flags;
+      packet.qpcPosition = event.qpc;
+      pipeline.Process(wakeup, packet);
+      // IAudioRenderClient::GetBuffer took the packet only if it fit.
+      if (!streamed && recordedQueued + event.frames <= format.renderBufferFrames)
+        recordedQueued += event.frames;
+
+      expectedDevicePosition = event.devicePosition + event.frames;
+      havePacket = true;
+      result.packets++;
+      result.frames += event.frames;
+    }
+  }
+
+  result.discontinuities = stats.captureDiscontinuities.load(std::memory_order_relaxed);
+  result.renderOverflows = stats.renderOverflows.load(std::memory_order_relaxed);
+  result.streamedFrames = stream.Frames();
+  if (streamed || result.wakeups == 0)
+    result.minRenderPadding = 0;
+}
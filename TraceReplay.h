@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "PacketTrace.h"
+
+struct PacketTraceReplayResult {
+  uint64_t wakeups = 0;
+  uint64_t packets = 0;
+  uint64_t frames = 0;
+  uint64_t discontinuities = 0;
+  uint64_t silentPackets = 0;
+  uint64_t devicePositionGaps = 0;
+  uint64_t renderOverflows = 0; // a packet that would not fit in the render buffer (GetBuffer fails)
+  uint64_t renderUnderruns = 0; // the render queue had drained by the time we woke up
+  uint64_t paddingMismatches = 0; // wakeups where the simulated queue depth differs from the recorded one
+  uint64_t streamedFrames = 0;  // frames handed to the network stream, for a streamed route
+  uint64_t maxWakeupIntervalUs = 0;
+  uint32_t minRenderPadding = UINT32_MAX;
+};
+
+// Replays a trace through the routing pipeline (RoutePipeline) that CLoopbackCapture runs on each
+// captured packet, into a simulated render queue. The queue starts at the first wakeup's recorded
+// padding; after that it fills only with what the pipeline queues and drains only by what the device
+// played, so overflows and underruns come from the simulation rather than from the recording. What
+// the device played between two wakeups is worked out from the recording: what the recorded route
+// had queued (its padding plus the packets that fit) less the padding it found next, or, if the
+// queue had run dry, at least the time between the wakeups. The recorded padding is otherwise only a
+// cross-check: wakeups where the simulated queue disagrees with it are counted as mismatches, which
+// means the pipeline queued something different from the recorded route, or the render device was
+// reopened during the trace. A trace of a route that was streaming to the network
+// (renderBufferFrames == 0) has no render queue: its packets go to a simulated stream instead, and
+// no wakeup counts as an underrun. Deterministic for a given trace.
+void ReplayPacketTrace(PacketTraceReader& reader, PacketTraceReplayResult& result);
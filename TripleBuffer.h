@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer handoff of the latest value of T.
+// The producer fills Back() and calls Publish(); the consumer calls Consume() at a point of its
+// choosing (e.g. a block boundary on the audio thread) and then reads Front(). Neither side ever
+// blocks or allocates, and the consumer always sees a complete value.
+template <typename T> class TripleBuffer {
+public:
+  // Producer side. Only one thread may produce at a time.
+  T& Back() { return m_slots[m_back]; }
+  void Publish() {
+    m_back = m_middle.exchange(static_cast<uint8_t>(m_back | kDirty), std::memory_order_acq_rel) & kIndexMask;
+  }
+
+  // Consumer side. Returns true if a newer value was swapped into Front().
+  bool Consume() {
+    if ((m_middle.load(std::memory_order_relaxed) & kDirty) == 0)
+      return false;
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+  const T& Front() const { return m_slots[m_front]; }
+
+private:
+  static const uint8_t kIndexMask = 0x3;
+  static const uint8_t kDirty = 0x4;
+
+  T m_slots[3];
+  uint8_t m_front = 0;
+  std::atomic<uint8_t> m_middle{ 1 };
+  uint8_t m_back = 2;
+};
@@ -0,0 +1,157 @@
+#include "Check.h"
+#include "AllocationCounter.h"
+#include "PacketTrace.h"
+#include "QosPolicy.h"
+#include "ReplayBuffer.h"
+#include "RouteArena.h"
+#include "RoutePipeline.h"
+#include "RouteStats.h"
+#include "RtpPacketizer.h"
+#include "TripleBuffer.h"
+
+#include <math.h>
+#include <memory>
+#include <vector>
+
+// Runs the portable part of the capture callback (parameter handoff, QoS policy, packet trace,
+// the routing pipeline with every stage enabled, the network sink's packetizer, stats) under the allocation counter, the way
+// CLoopbackCapture::OnAudioSampleRequested does, and checks that the steady state never touches
+// the heap. Everything the audio thread uses is allocated up front, as the router does it.
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kChannels = 2;
+static const uint32_t kPacketFrames = 480;
+static const uint32_t kRenderBufferFrames = 4800;
+
+// Render queue with IAudioRenderClient's contract over a buffer allocated up front. Drains by one
+// packet per wakeup, as the device would.
+class PreallocatedRenderQueue : public RenderTarget {
+public:
+  PreallocatedRenderQueue(uint32_t capacityFrames, uint32_t blockAlign) :
+    m_capacityFrames(capacityFrames), m_buffer(new uint8_t[capacityFrames * blockAlign]) {}
+
+  void Drain(uint32_t frames) { m_queuedFrames = (m_queuedFrames > frames) ? m_queuedFrames - frames : 0; }
+
+  RenderStatus GetBuffer(uint32_t frames, uint8_t** buffer) override {
+    if (m_queuedFrames + frames > m_capacityFrames)
+      return RenderStatus::Full;
+    *buffer = m_buffer.get();
+    return RenderStatus::Ok;
+  }
+
+  void ReleaseBuffer(uint32_t frames, bool) override { m_queuedFrames += frames; }
+
+private:
+  uint32_t m_capacityFrames;
+  uint32_t m_queuedFrames = 0;
+  std::unique_ptr<uint8_t[]> m_buffer;
+};
+
+// Counts the datagrams the packetizer hands over, without sending them.
+class CountingSender : public RtpPacketSender {
+public:
+  void SendPacket(const uint8_t*, uint32_t) override { packets++; }
+
+  uint64_t packets = 0;
+};
+
+struct RouteParams {
+  float gain = 1.0f;
+  bool qosEnabled = true;
+};
+
+static void TestCounterSeesAllocations() {
+  uint64_t before = ThreadAllocationCount();
+  std::unique_ptr<int> allocated(new int(1));
+  std::vector<float> vector(16);
+  CHECK_EQ(before + 2, ThreadAllocationCount());
+}
+
+static void TestSteadyStateDoesNotAllocate(bool stream, bool exclusive) {
+  RouteStats stats;
+  RoutePipeline pipeline(stats);
+  QosPolicy qos;
+  TripleBuffer<RouteParams> paramsHandoff;
+  PacketTraceWriter trace(1 << 20, PacketTraceFormat());
+  ReplayBuffer replay(kSampleRate, kChannels, 10);
+  RouteArena arena;
+  CHECK(arena.Reset(RouteArena::AlignedSize(kRenderBufferFrames * kChannels * sizeof(float))));
+  PreallocatedRenderQueue renderQueue(kRenderBufferFrames, kChannels * sizeof(float));
+  CountingSender sender;
+  RtpPacketizer networkStream(sender);
+  CHECK(networkStream.Reset(kChannels, kSampleRate, true, 0, 1));
+
+  std::vector<float> captured(kPacketFrames * kChannels);
+  for (uint32_t i = 0; i < captured.size(); ++i)
+    captured[i] = 0.25f * sinf((float) (i / kChannels) * 0.0576f);
+
+  RouteWakeup wakeup;
+  wakeup.sampleRate = kSampleRate;
+  wakeup.channels = kChannels;
+  wakeup.blockAlign = kChannels * sizeof(float);
+  wakeup.isFloat = true;
+  wakeup.processBufferFrames = kRenderBufferFrames;
+  wakeup.processBuffer = arena.Allocate<float>(kRenderBufferFrames * kChannels);
+  wakeup.replay = &replay;
+  wakeup.exclusive = exclusive;
+  wakeup.renderFormat.sampleRate = kSampleRate;
+  wakeup.renderFormat.channels = kChannels;
+  wakeup.renderFormat.sampleType = PcmSampleType::Int24;
+
+  RouteParams activeParams;
+  uint64_t qpc = 10000000;
+  uint32_t levelChanges = 0;
+  uint64_t allocationsAtStart = ThreadAllocationCount();
+  for (uint32_t callback = 0; callback < 2000; ++callback) {
+    // Control thread retunes the gain now and then; the handoff itself never allocates.
+    if (callback % 100 == 0) {
+      paramsHandoff.Back().gain = 0.5f + (float) (callback % 300) / 1000.0f;
+      paramsHandoff.Publish();
+    }
+    if (paramsHandoff.Consume())
+      activeParams = paramsHandoff.Front();
+
+    wakeup.gain = activeParams.gain;
+    wakeup.qosLevel = qos.Level();
+    wakeup.stream = stream ? &networkStream : nullptr;
+    wakeup.render = stream ? nullptr : &renderQueue;
+    renderQueue.Drain(kPacketFrames);
+    trace.RecordWakeup(qpc, kPacketFrames);
+
+    RoutePacket packet;
+    packet.data = reinterpret_cast<const uint8_t*>(captured.data());
+    packet.frames = kPacketFrames;
+    packet.flags = (callback % 500 == 250) ? PACKET_TRACE_FLAG_SILENT : 0;
+    packet.qpcPosition = qpc;
+    trace.RecordPacket(packet.frames, packet.flags, (uint64_t) callback * kPacketFrames, qpc);
+    pipeline.Process(wakeup, packet);
+    if (stream)
+      networkStream.Flush();
+
+    // Alternate light and heavy load so the policy sheds and restores stages along the way.
+    uint32_t usagePercent = (callback / 400) % 2 ? 90 : 20;
+    stats.deadlineUsagePercent.Record(usagePercent);
+    stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+    levelChanges += qos.Update(usagePercent) ? 1 : 0;
+    qpc += (uint64_t) kPacketFrames * 10000000 / kSampleRate;
+  }
+  uint64_t allocations = ThreadAllocationCount() - allocationsAtStart;
+
+  printf("%s%s path: %llu allocations over 2000 callbacks\n", stream ? "stream" : "render", exclusive ? " (exclusive)" : "",
+    (unsigned long long) allocations);
+  CHECK_EQ(0u, allocations);
+  // Make sure the stages under test actually ran.
+  CHECK(replay.BlocksEncoded() > 0);
+  CHECK(pipeline.TakePeak() > 0.0f);
+  CHECK(levelChanges >= 4);
+  CHECK_EQ(stream ? 2 * 2000u : 0u, sender.packets); // a full packet and the remainder per callback
+  CHECK(!trace.IsTruncated());
+}
+
+int main() {
+  TestCounterSeesAllocations();
+  TestSteadyStateDoesNotAllocate(false, false);
+  TestSteadyStateDoesNotAllocate(false, true);
+  TestSteadyStateDoesNotAllocate(true, false);
+  return CheckResult();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal assertion helpers for the portable tests: each test is a plain executable that reports
+// every failed check and exits nonzero if there were any.
+static int g_checkFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+      g_checkFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(expected, actual) CHECK((expected) == (actual))
+
+inline int CheckResult() {
+  if (g_checkFailures != 0) {
+    fprintf(stderr, "%d check(s) failed\n", g_checkFailures);
+    return 1;
+  }
+  return 0;
+}
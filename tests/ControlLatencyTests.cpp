@@ -0,0 +1,193 @@
+#include "Check.h"
+#include "LocalControlSocket.h"
+#include "RouteSpec.h"
+#include "TripleBuffer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Command-to-effect latency harness. Reproduces the router's control path without an audio stack:
+// commands go over the socket stand-in to a handler on the channel thread, which parses them with
+// the router's own parsers. A gain change is published through a TripleBuffer the way
+// CLoopbackCapture does, and picked up by a simulated audio thread at a block boundary; its latency
+// is measured from the client sending the command to the audio thread running with the new gain.
+// A buffer change is only queued for the router thread, as HandleControlCommand() does: the router
+// applies it by reopening the render device, which this harness doesn't model, so no latency is
+// reported for it.
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct RouteParams {
+  float gain = 1.0f;
+  int64_t publishNs = 0;
+};
+
+static const int kBlockUs = 2667; // 128 frames at 48 kHz, how often the simulated audio thread runs
+
+class SimulatedRoute {
+public:
+  SimulatedRoute() : m_audioThread([this]() { AudioThread(); }) {}
+  ~SimulatedRoute() {
+    m_stop = true;
+    m_audioThread.join();
+  }
+
+  // HandleControlCommand() for the commands that retune a running route.
+  std::wstring HandleCommand(const std::wstring& command) {
+    std::wstring verb, argument;
+    SplitControlCommand(command, verb, argument);
+
+    if (verb == L"gain") {
+      float gainDb;
+      if (!ParseGainDb(argument, gainDb))
+        return L"error: gain expects a value in dB between -96 and 24";
+      std::lock_guard<std::mutex> lock(m_paramsLock);
+      m_params.gain = powf(10.0f, gainDb / 20.0f);
+      m_params.publishNs = NowNs();
+      m_handoff.Back() = m_params;
+      m_handoff.Publish();
+      return L"ok";
+    } else if (verb == L"buffer") {
+      uint32_t bufferMs;
+      if (!ParseRenderBufferMs(argument, bufferMs))
+        return L"error: buffer expects a render buffer length in milliseconds between 1 and 2000";
+      std::lock_guard<std::mutex> lock(m_outputLock);
+      m_output.renderBufferMs = bufferMs;
+      m_outputChanged = true;
+      return L"ok";
+    }
+    return L"error: unknown command";
+  }
+
+  // Waits for the audio thread to run with `gain`, and returns when it started doing so.
+  bool WaitForGain(float gain, int64_t& appliedNs) {
+    for (int i = 0; i < 2000; ++i) {
+      if (m_appliedGain.load(std::memory_order_acquire) == gain) {
+        appliedNs = m_appliedNs.load(std::memory_order_relaxed);
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    return false;
+  }
+
+  // The output change waiting for the router thread, if any.
+  bool PendingOutput(RouteOutput& output) {
+    std::lock_guard<std::mutex> lock(m_outputLock);
+    output = m_output;
+    return m_outputChanged;
+  }
+
+  int64_t MaxPublishToApplyNs() const { return m_maxPublishToApplyNs.load(std::memory_order_relaxed); }
+
+private:
+  void AudioThread() {
+    RouteParams active;
+    while (!m_stop) {
+      // Block boundary: pick up whatever was published since the last one.
+      if (m_handoff.Consume()) {
+        active = m_handoff.Front();
+        int64_t now = NowNs();
+        m_maxPublishToApplyNs.store(std::max(m_maxPublishToApplyNs.load(std::memory_order_relaxed), now - active.publishNs), std::memory_order_relaxed);
+        m_appliedNs.store(now, std::memory_order_relaxed);
+        m_appliedGain.store(active.gain, std::memory_order_release);
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(kBlockUs));
+    }
+  }
+
+  std::mutex m_paramsLock;
+  RouteParams m_params;
+  TripleBuffer<RouteParams> m_handoff;
+
+  std::mutex m_outputLock;
+  RouteOutput m_output;
+  bool m_outputChanged = false;
+
+  std::atomic<bool> m_stop{ false };
+  std::atomic<float> m_appliedGain{ 1.0f };
+  std::atomic<int64_t> m_appliedNs{ 0 };
+  std::atomic<int64_t> m_maxPublishToApplyNs{ 0 };
+  std::thread m_audioThread;
+};
+
+static std::string SocketPath() {
+  const char* tmp = getenv("TMPDIR");
+  std::string path = (tmp && *tmp) ? tmp : "/tmp";
+  return path + "/AudioRouter." + std::to_string(getpid());
+}
+
+static void TestRoundTrip(const std::string& path, SimulatedRoute& route) {
+  std::wstring reply;
+  CHECK(LocalControlSocket::SendCommand(path, L"gain 100", reply));
+  CHECK(reply.compare(0, 6, L"error:") == 0);
+  CHECK(LocalControlSocket::SendCommand(path, L"bogus", reply));
+  CHECK(reply == L"error: unknown command");
+  // Trailing whitespace and terminators are trimmed, as on the named pipe.
+  CHECK(LocalControlSocket::SendCommand(path, std::wstring(L"buffer 40\r\n") + L'\0', reply));
+  CHECK(reply == L"ok");
+  CHECK(LocalControlSocket::SendCommand(path, L"buffer 0", reply));
+  CHECK(reply.compare(0, 6, L"error:") == 0);
+  RouteOutput output;
+  CHECK(route.PendingOutput(output));
+  CHECK_EQ(40u, output.renderBufferMs);
+}
+
+static void TestCommandToEffectLatency(const std::string& path, SimulatedRoute& route) {
+  const int kCommands = 100;
+  std::vector<int64_t> latencies;
+  for (int i = 0; i < kCommands; ++i) {
+    int gainDb = -(i % 40) - 1;
+    float expectedGain = powf(10.0f, (float) gainDb / 20.0f);
+
+    int64_t sentNs = NowNs();
+    std::wstring reply;
+    CHECK(LocalControlSocket::SendCommand(path, L"gain " + std::to_wstring(gainDb), reply));
+    CHECK(reply == L"ok");
+    int64_t appliedNs = 0;
+    bool applied = route.WaitForGain(expectedGain, appliedNs);
+    CHECK(applied);
+    if (applied)
+      latencies.push_back(appliedNs - sentNs);
+  }
+  if (latencies.empty())
+    return;
+
+  std::sort(latencies.begin(), latencies.end());
+  int64_t medianUs = latencies[latencies.size() / 2] / 1000;
+  int64_t p99Us = latencies[latencies.size() * 99 / 100] / 1000;
+  int64_t maxUs = latencies.back() / 1000;
+  printf("gain command-to-effect latency over %zu commands: median %lld us, p99 %lld us, max %lld us "
+    "(block %d us); publish-to-apply max %lld us\n", latencies.size(), (long long) medianUs, (long long) p99Us,
+    (long long) maxUs, kBlockUs, (long long) (route.MaxPublishToApplyNs() / 1000));
+
+  // A change lands at the next block boundary; allow generously for a loaded test machine.
+  CHECK(medianUs < 10 * kBlockUs);
+  CHECK(maxUs < 500000);
+}
+
+int main() {
+  std::string path = SocketPath();
+  SimulatedRoute route;
+  LocalControlSocket channel(path, [&](const std::wstring& command) { return route.HandleCommand(command); });
+  CHECK(channel.IsServing());
+  if (channel.IsServing()) {
+    TestRoundTrip(path, route);
+    TestCommandToEffectLatency(path, route);
+  }
+
+  std::wstring reply;
+  CHECK(!LocalControlSocket::SendCommand(path + ".missing", L"status", reply));
+  return CheckResult();
+}
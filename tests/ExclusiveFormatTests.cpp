@@ -0,0 +1,235 @@
+#include "Check.h"
+#include "ExclusiveFormat.h"
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// Exclusive-mode format negotiation against a fake device, and the float-to-PCM conversions used
+// for whatever format it settles on.
+
+// Accepts only the formats it was given, and remembers what it was asked, in order.
+class FakeDevice {
+public:
+  void Support(uint32_t sampleRate, uint16_t channels, PcmSampleType sampleType) {
+    PcmFormat format;
+    format.sampleRate = sampleRate;
+    format.channels = channels;
+    format.sampleType = sampleType;
+    m_supported.push_back(format);
+  }
+
+  bool Negotiate(uint32_t mixSampleRate, uint16_t mixChannels, PcmFormat& negotiated) {
+    m_probes.clear();
+    return NegotiateExclusiveFormat(mixSampleRate, mixChannels, [this](const PcmFormat& format) {
+      m_probes.push_back(format);
+      for (const PcmFormat& supported : m_supported) {
+        if (SameFormat(supported, format))
+          return true;
+      }
+      return false;
+    }, negotiated);
+  }
+
+  size_t Probes() const { return m_probes.size(); }
+
+  static bool SameFormat(const PcmFormat& a, const PcmFormat& b) {
+    return a.sampleRate == b.sampleRate && a.channels == b.channels && a.sampleType == b.sampleType;
+  }
+
+private:
+  std::vector<PcmFormat> m_supported;
+  std::vector<PcmFormat> m_probes;
+};
+
+static void TestMixFormatWinsWhenSupported() {
+  FakeDevice device;
+  device.Support(48000, 2, PcmSampleType::Int16);
+  device.Support(48000, 2, PcmSampleType::Float32);
+  PcmFormat negotiated;
+  CHECK(device.Negotiate(48000, 2, negotiated));
+  CHECK(negotiated.sampleType == PcmSampleType::Float32);
+  CHECK_EQ(1u, device.Probes());
+}
+
+static void TestPrefersDeepestSampleType() {
+  // A typical 24-bit DAC: 24 bits in a 32-bit container, or packed, or 16 bits.
+  FakeDevice device;
+  device.Support(48000, 2, PcmSampleType::Int16);
+  device.Support(48000, 2, PcmSampleType::Int24);
+  device.Support(48000, 2, PcmSampleType::Int24In32);
+  PcmFormat negotiated;
+  CHECK(device.Negotiate(48000, 2, negotiated));
+  CHECK(negotiated.sampleType == PcmSampleType::Int24In32);
+  CHECK_EQ(48000u, negotiated.sampleRate);
+  CHECK_EQ(3u, device.Probes());
+}
+
+static void TestFallsBackOnRateThenChannels() {
+  // A 5.1 mix on a stereo-only 44.1 kHz 16-bit device: every 6-channel candidate is tried first,
+  // then stereo at the mix rate, then stereo at 44.1 kHz.
+  FakeDevice device;
+  device.Support(44100, 2, PcmSampleType::Int16);
+  PcmFormat negotiated;
+  CHECK(device.Negotiate(48000, 6, negotiated));
+  CHECK_EQ(44100u, negotiated.sampleRate);
+  CHECK_EQ(2, negotiated.channels);
+  CHECK(negotiated.sampleType == PcmSampleType::Int16);
+  CHECK_EQ(15u + 5u + 5u, device.Probes());
+
+  // A rate other than the mix rate wins over a channel count other than the mix's.
+  FakeDevice multichannel;
+  multichannel.Support(96000, 6, PcmSampleType::Int32);
+  multichannel.Support(48000, 2, PcmSampleType::Float32);
+  CHECK(multichannel.Negotiate(48000, 6, negotiated));
+  CHECK_EQ(96000u, negotiated.sampleRate);
+  CHECK_EQ(6, negotiated.channels);
+}
+
+static void TestNothingSupportedFallsBackToShared() {
+  FakeDevice device;
+  device.Support(22050, 1, PcmSampleType::Int16);
+  PcmFormat negotiated;
+  negotiated.sampleRate = 12345;
+  CHECK(!device.Negotiate(48000, 2, negotiated));
+  CHECK_EQ(12345u, negotiated.sampleRate); // untouched
+  CHECK_EQ(3u * 5u, device.Probes());
+}
+
+static void TestCandidateList() {
+  // The mix rate isn't repeated among the fallbacks, nor stereo among the channel counts.
+  std::vector<PcmFormat> candidates = ExclusiveFormatCandidates(44100, 2);
+  CHECK_EQ((size_t) 15, candidates.size());
+  CHECK_EQ(44100u, candidates[0].sampleRate);
+  CHECK_EQ(48000u, candidates[5].sampleRate);
+  CHECK_EQ(96000u, candidates[10].sampleRate);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    for (size_t j = i + 1; j < candidates.size(); ++j)
+      CHECK(!FakeDevice::SameFormat(candidates[i], candidates[j]));
+  }
+  CHECK_EQ((size_t) 30, ExclusiveFormatCandidates(48000, 8).size());
+}
+
+static int32_t ReadInt24(const uint8_t* src) {
+  return (int32_t) ((uint32_t) src[0] << 8 | (uint32_t) src[1] << 16 | (uint32_t) src[2] << 24) >> 8;
+}
+
+static void TestConversion() {
+  const float src[] = { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 1.5f, -1.5f };
+  const size_t count = sizeof(src) / sizeof(src[0]);
+
+  int16_t int16[count];
+  ConvertFloatToPcm(src, reinterpret_cast<uint8_t*>(int16), count, PcmSampleType::Int16);
+  const int16_t expected16[] = { 0, 16384, -16384, 32767, -32768, 32767, -32768 };
+  CHECK(memcmp(int16, expected16, sizeof(expected16)) == 0);
+
+  uint8_t int24[count * 3];
+  ConvertFloatToPcm(src, int24, count, PcmSampleType::Int24);
+  const int32_t expected24[] = { 0, 4194304, -4194304, 8388607, -8388608, 8388607, -8388608 };
+  for (size_t i = 0; i < count; ++i)
+    CHECK_EQ(expected24[i], ReadInt24(int24 + i * 3));
+
+  int32_t int32[count];
+  ConvertFloatToPcm(src, reinterpret_cast<uint8_t*>(int32), count, PcmSampleType::Int24In32);
+  const int32_t expected32[] = { 0, 1073741824, -1073741824, INT32_MAX, INT32_MIN, INT32_MAX, INT32_MIN };
+  CHECK(memcmp(int32, expected32, sizeof(expected32)) == 0);
+
+  float float32[count];
+  ConvertFloatToPcm(src, reinterpret_cast<uint8_t*>(float32), count, PcmSampleType::Float32);
+  CHECK(memcmp(float32, src, sizeof(src)) == 0);
+}
+
+static void TestRoundingIsSymmetric() {
+  // Levels between steps go to the nearest one, and a negative level lands exactly opposite its
+  // positive twin; truncation would put both on the step nearer zero.
+  const float steps[] = { 0.3f, 0.7f, 1000.4f, 1000.6f, 12345.49f, 12345.51f };
+  const int32_t nearest[] = { 0, 1, 1000, 1001, 12345, 12346 };
+  const size_t count = sizeof(steps) / sizeof(steps[0]);
+  for (size_t i = 0; i < count; ++i) {
+    float positive16 = steps[i] / 32768.0f;
+    float negative16 = -positive16;
+    int16_t int16[2];
+    ConvertFloatToPcm(&positive16, reinterpret_cast<uint8_t*>(&int16[0]), 1, PcmSampleType::Int16);
+    ConvertFloatToPcm(&negative16, reinterpret_cast<uint8_t*>(&int16[1]), 1, PcmSampleType::Int16);
+    CHECK_EQ(nearest[i], int16[0]);
+    CHECK_EQ(-nearest[i], int16[1]);
+
+    float positive24 = steps[i] / 8388608.0f;
+    float negative24 = -positive24;
+    uint8_t int24[6];
+    ConvertFloatToPcm(&positive24, int24, 1, PcmSampleType::Int24);
+    ConvertFloatToPcm(&negative24, int24 + 3, 1, PcmSampleType::Int24);
+    CHECK_EQ(nearest[i], ReadInt24(int24));
+    CHECK_EQ(-nearest[i], ReadInt24(int24 + 3));
+
+    float positive32 = steps[i] / 2147483648.0f;
+    float negative32 = -positive32;
+    int32_t int32[2];
+    ConvertFloatToPcm(&positive32, reinterpret_cast<uint8_t*>(&int32[0]), 1, PcmSampleType::Int24In32);
+    ConvertFloatToPcm(&negative32, reinterpret_cast<uint8_t*>(&int32[1]), 1, PcmSampleType::Int24In32);
+    CHECK_EQ(nearest[i], int32[0]);
+    CHECK_EQ(-nearest[i], int32[1]);
+  }
+}
+
+static void TestDither() {
+  // More than one dither chunk, at a level between two 16-bit steps.
+  const size_t count = 1000;
+  std::vector<float> src(count, 1000.4f / 32768.0f);
+  std::vector<int16_t> dst(count + 1, 0x5555);
+  uint32_t ditherState = 1;
+  ConvertFloatToPcmDithered(src.data(), reinterpret_cast<uint8_t*>(dst.data()), count, PcmSampleType::Int16, ditherState);
+  CHECK(dst[count] == 0x5555); // nothing written past the end
+  CHECK(ditherState != 1);
+
+  int64_t sum = 0;
+  int16_t lowest = INT16_MAX, highest = INT16_MIN;
+  for (size_t i = 0; i < count; ++i) {
+    sum += dst[i];
+    lowest = (dst[i] < lowest) ? dst[i] : lowest;
+    highest = (dst[i] > highest) ? dst[i] : highest;
+  }
+  // Triangular dither reaches up to a step either way, and rounding leaves the average at the level.
+  CHECK(lowest >= 999 && highest <= 1001 && lowest < highest);
+  double mean = (double) sum / count;
+  CHECK(mean > 1000.3 && mean < 1000.5);
+
+  // The same level below zero averages the same distance below zero.
+  std::vector<float> negative(count, -1000.4f / 32768.0f);
+  std::vector<int16_t> negativeDst(count);
+  uint32_t negativeState = 1;
+  ConvertFloatToPcmDithered(negative.data(), reinterpret_cast<uint8_t*>(negativeDst.data()), count, PcmSampleType::Int16, negativeState);
+  int64_t negativeSum = 0;
+  for (size_t i = 0; i < count; ++i)
+    negativeSum += negativeDst[i];
+  double negativeMean = (double) negativeSum / count;
+  printf("dithered 16-bit mean of +/-1000.4 steps: %.3f, %.3f\n", mean, negativeMean);
+  CHECK(negativeMean < -1000.3 && negativeMean > -1000.5);
+  CHECK(fabs(mean + negativeMean) < 0.1);
+
+  // The same state gives the same noise, and the state carries on between calls.
+  std::vector<int16_t> again(count);
+  uint32_t sameState = 1;
+  ConvertFloatToPcmDithered(src.data(), reinterpret_cast<uint8_t*>(again.data()), count, PcmSampleType::Int16, sameState);
+  CHECK(again == std::vector<int16_t>(dst.begin(), dst.begin() + count));
+  CHECK_EQ(ditherState, sameState);
+
+  // 32-bit containers aren't dithered.
+  int32_t dithered32[4], plain32[4];
+  const float quiet[4] = { 1e-6f, -1e-6f, 0.25f, 0.0f };
+  ConvertFloatToPcmDithered(quiet, reinterpret_cast<uint8_t*>(dithered32), 4, PcmSampleType::Int24In32, ditherState);
+  ConvertFloatToPcm(quiet, reinterpret_cast<uint8_t*>(plain32), 4, PcmSampleType::Int24In32);
+  CHECK(memcmp(dithered32, plain32, sizeof(plain32)) == 0);
+}
+
+int main() {
+  TestMixFormatWinsWhenSupported();
+  TestPrefersDeepestSampleType();
+  TestFallsBackOnRateThenChannels();
+  TestNothingSupportedFallsBackToShared();
+  TestCandidateList();
+  TestConversion();
+  TestRoundingIsSymmetric();
+  TestDither();
+  return CheckResult();
+}
@@ -0,0 +1,168 @@
+#include "Check.h"
+#include "Rtp.h"
+#include "AudioRouterInjector/JitterBuffer.h"
+
+#include <vector>
+
+// Tests for the receiver's jitter buffer: reordering, loss, late packets, underruns, and the two
+// kinds of resync (sender restart and clock drift).
+
+static const uint32_t kChannels = 2;
+static const uint32_t kPacketFrames = 128;
+static const uint32_t kTargetFrames = 256;
+static const uint32_t kCapacityFrames = 4096;
+
+// Each sample encodes its frame's timestamp, so playout order can be checked from the output.
+static int16_t SampleFor(uint32_t timestamp, uint32_t channel) {
+  return (int16_t) (((timestamp & 0x3fff) << 1) | channel) + 1;
+}
+
+static void InsertPacket(JitterBuffer& buffer, uint32_t timestamp) {
+  std::vector<int16_t> samples(kPacketFrames * kChannels);
+  for (uint32_t frame = 0; frame < kPacketFrames; ++frame) {
+    for (uint32_t ch = 0; ch < kChannels; ++ch)
+      samples[frame * kChannels + ch] = SampleFor(timestamp + frame, ch);
+  }
+  std::vector<uint8_t> payload(samples.size() * 2);
+  Int16ToL16(samples.data(), payload.data(), samples.size());
+  buffer.Insert(timestamp, payload.data(), kPacketFrames);
+}
+
+// Reads exactly frameCount frames and checks they play timestamps [first, first + frameCount),
+// except for frames in [silentFrom, silentTo), which must be silence.
+static void ExpectPlayout(JitterBuffer& buffer, uint32_t first, uint32_t frameCount, uint32_t silentFrom = 0, uint32_t silentTo = 0) {
+  std::vector<int16_t> output(frameCount * kChannels);
+  CHECK_EQ(frameCount, buffer.Read(output.data(), frameCount));
+  bool matches = true;
+  for (uint32_t frame = 0; frame < frameCount; ++frame) {
+    uint32_t timestamp = first + frame;
+    bool silent = (int32_t) (timestamp - silentFrom) >= 0 && (int32_t) (timestamp - silentTo) < 0;
+    for (uint32_t ch = 0; ch < kChannels; ++ch)
+      matches &= output[frame * kChannels + ch] == (silent ? 0 : SampleFor(timestamp, ch));
+  }
+  CHECK(matches);
+}
+
+static void TestBuffersToTargetThenPlaysInOrder() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  int16_t output[kPacketFrames * kChannels];
+  CHECK_EQ(0u, buffer.Read(output, kPacketFrames)); // nothing received yet
+
+  InsertPacket(buffer, 1000);
+  CHECK_EQ(0u, buffer.Read(output, kPacketFrames)); // below target depth
+  InsertPacket(buffer, 1000 + kPacketFrames);
+  CHECK_EQ(kTargetFrames, buffer.BufferedFrames());
+  ExpectPlayout(buffer, 1000, kPacketFrames);
+  ExpectPlayout(buffer, 1000 + kPacketFrames, kPacketFrames);
+  CHECK_EQ(0u, buffer.GetStats().concealedFrames);
+}
+
+static void TestReordering() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  const uint32_t order[] = { 0, 2, 1, 3, 5, 4 };
+  for (uint32_t packet : order)
+    InsertPacket(buffer, packet * kPacketFrames);
+
+  ExpectPlayout(buffer, 0, 6 * kPacketFrames);
+  const JitterBuffer::Stats& stats = buffer.GetStats();
+  CHECK_EQ(0u, stats.latePackets);
+  CHECK_EQ(0u, stats.concealedFrames);
+}
+
+static void TestLossIsConcealedAndLatePacketsDropped() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  InsertPacket(buffer, 0);
+  InsertPacket(buffer, 2 * kPacketFrames); // packet 1 is missing
+  InsertPacket(buffer, 3 * kPacketFrames);
+  ExpectPlayout(buffer, 0, 3 * kPacketFrames, kPacketFrames, 2 * kPacketFrames);
+  CHECK_EQ(kPacketFrames, (uint32_t) buffer.GetStats().concealedFrames);
+
+  // Packet 1 shows up after its slot was played: it must not be played now.
+  InsertPacket(buffer, kPacketFrames);
+  CHECK_EQ(1u, buffer.GetStats().latePackets);
+  ExpectPlayout(buffer, 3 * kPacketFrames, kPacketFrames);
+
+  // A packet straddling the playout position keeps only its unplayed part.
+  InsertPacket(buffer, 4 * kPacketFrames);
+  ExpectPlayout(buffer, 4 * kPacketFrames, kPacketFrames / 2);
+  InsertPacket(buffer, 4 * kPacketFrames);
+  CHECK_EQ(1u, buffer.GetStats().latePackets);
+  ExpectPlayout(buffer, 4 * kPacketFrames + kPacketFrames / 2, kPacketFrames / 2);
+}
+
+static void TestUnderrunRebuffers() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  InsertPacket(buffer, 0);
+  InsertPacket(buffer, kPacketFrames);
+  ExpectPlayout(buffer, 0, 2 * kPacketFrames);
+
+  int16_t output[kPacketFrames * kChannels];
+  CHECK_EQ(0u, buffer.Read(output, kPacketFrames));
+  CHECK_EQ(1u, buffer.GetStats().underruns);
+
+  // Playback resumes only once the target depth is back.
+  InsertPacket(buffer, 2 * kPacketFrames);
+  CHECK_EQ(0u, buffer.Read(output, kPacketFrames));
+  InsertPacket(buffer, 3 * kPacketFrames);
+  ExpectPlayout(buffer, 2 * kPacketFrames, kPacketFrames);
+}
+
+static void TestSenderRestartResyncs() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  InsertPacket(buffer, 0);
+  InsertPacket(buffer, kPacketFrames);
+  ExpectPlayout(buffer, 0, kPacketFrames);
+
+  // A restarted sender picks a new random timestamp base.
+  const uint32_t restart = 0x40000000;
+  InsertPacket(buffer, restart);
+  CHECK_EQ(1u, buffer.GetStats().resyncs);
+  CHECK_EQ(kPacketFrames, buffer.BufferedFrames());
+  InsertPacket(buffer, restart + kPacketFrames);
+  ExpectPlayout(buffer, restart, 2 * kPacketFrames);
+}
+
+static void TestTimestampWraparound() {
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  const uint32_t start = 0u - kPacketFrames * 2;
+  for (uint32_t packet = 0; packet < 4; ++packet)
+    InsertPacket(buffer, start + packet * kPacketFrames);
+  ExpectPlayout(buffer, start, 4 * kPacketFrames);
+  CHECK_EQ(0u, buffer.GetStats().resyncs);
+}
+
+static void TestClockDriftIsBounded() {
+  // The sender runs fast: one extra packet arrives for every ten read.
+  JitterBuffer buffer(kChannels, kTargetFrames, kCapacityFrames);
+  uint32_t nextTimestamp = 0;
+  InsertPacket(buffer, nextTimestamp);
+  nextTimestamp += kPacketFrames;
+  uint32_t maxDepth = 0;
+  int16_t output[kPacketFrames * kChannels];
+  for (int block = 0; block < 500; ++block) {
+    int packets = (block % 10 == 0) ? 2 : 1;
+    for (int i = 0; i < packets; ++i) {
+      InsertPacket(buffer, nextTimestamp);
+      nextTimestamp += kPacketFrames;
+    }
+    if (buffer.BufferedFrames() > maxDepth)
+      maxDepth = buffer.BufferedFrames();
+    buffer.Read(output, kPacketFrames);
+  }
+  const JitterBuffer::Stats& stats = buffer.GetStats();
+  CHECK(stats.resyncs > 0);
+  CHECK_EQ(0u, stats.underruns);
+  // Latency stays bounded instead of growing by a packet every ten.
+  CHECK(maxDepth <= 2 * kTargetFrames + 2 * kPacketFrames);
+}
+
+int main() {
+  TestBuffersToTargetThenPlaysInOrder();
+  TestReordering();
+  TestLossIsConcealedAndLatePacketsDropped();
+  TestUnderrunRebuffers();
+  TestSenderRestartResyncs();
+  TestTimestampWraparound();
+  TestClockDriftIsBounded();
+  return CheckResult();
+}
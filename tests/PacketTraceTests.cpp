@@ -0,0 +1,156 @@
+#include "Check.h"
+#include "PacketTrace.h"
+
+#include <vector>
+
+// Packet trace encoding: events come back exactly as recorded, a full buffer truncates cleanly,
+// damaged files are rejected, and the encoding stays compact.
+
+static PacketTraceFormat TestFormat() {
+  PacketTraceFormat format;
+  format.sampleRate = 48000;
+  format.channels = 2;
+  format.captureBufferFrames = 4800;
+  format.renderBufferFrames = 9600;
+  return format;
+}
+
+static std::vector<PacketTraceEvent> ReadAll(const std::vector<uint8_t>& bytes, bool& clean) {
+  std::vector<PacketTraceEvent> events;
+  PacketTraceReader reader;
+  clean = reader.Open(bytes.data(), bytes.size());
+  PacketTraceEvent event;
+  while (clean && reader.Next(event))
+    events.push_back(event);
+  return events;
+}
+
+static void TestRoundTrip() {
+  PacketTraceWriter writer(4096, TestFormat());
+  writer.RecordWakeup(50000000, 960);
+  // A packet's QPC position is that of its first frame, so it is earlier than the wakeup.
+  writer.RecordPacket(480, 0, 0, 49900000);
+  writer.RecordPacket(480, PACKET_TRACE_FLAG_DATA_DISCONTINUITY, 1000, 49950000); // position jumped
+  writer.RecordWakeup(50100000, 0);
+  writer.RecordPacket(480, PACKET_TRACE_FLAG_SILENT | PACKET_TRACE_FLAG_TIMESTAMP_ERROR, 1480, 0);
+  writer.RecordWakeup(0xffffffffffull, UINT32_MAX);
+  CHECK(!writer.IsTruncated());
+
+  std::vector<uint8_t> bytes;
+  writer.Serialize(bytes);
+  PacketTraceReader reader;
+  CHECK(reader.Open(bytes.data(), bytes.size()));
+  CHECK_EQ(48000u, reader.Format().sampleRate);
+  CHECK_EQ(2u, reader.Format().channels);
+  CHECK_EQ(4800u, reader.Format().captureBufferFrames);
+  CHECK_EQ(9600u, reader.Format().renderBufferFrames);
+  CHECK(!reader.IsTruncated());
+
+  bool clean = false;
+  std::vector<PacketTraceEvent> events = ReadAll(bytes, clean);
+  CHECK(clean);
+  CHECK_EQ((size_t) 6, events.size());
+  if (events.size() != 6)
+    return;
+  CHECK(events[0].type == PacketTraceEvent::Type::Wakeup);
+  CHECK_EQ(50000000u, events[0].qpc);
+  CHECK_EQ(960u, events[0].renderPadding);
+  CHECK(events[1].type == PacketTraceEvent::Type::Packet);
+  CHECK_EQ(480u, events[1].frames);
+  CHECK_EQ(0u, events[1].devicePosition);
+  CHECK_EQ(49900000u, events[1].qpc);
+  CHECK_EQ((uint32_t) PACKET_TRACE_FLAG_DATA_DISCONTINUITY, events[2].flags);
+  CHECK_EQ(1000u, events[2].devicePosition);
+  CHECK_EQ(49950000u, events[2].qpc);
+  CHECK_EQ(0u, events[3].renderPadding);
+  CHECK_EQ((uint32_t) (PACKET_TRACE_FLAG_SILENT | PACKET_TRACE_FLAG_TIMESTAMP_ERROR), events[4].flags);
+  CHECK_EQ(1480u, events[4].devicePosition);
+  CHECK_EQ(0u, events[4].qpc);
+  CHECK_EQ(0xffffffffffull, events[5].qpc);
+  CHECK_EQ(UINT32_MAX, events[5].renderPadding);
+}
+
+static void TestTruncation() {
+  PacketTraceWriter writer(256, TestFormat());
+  uint64_t qpc = 10000000;
+  int recorded = 0;
+  for (int i = 0; i < 100; ++i, qpc += 100000) {
+    writer.RecordWakeup(qpc, 960);
+    writer.RecordPacket(480, 0, (uint64_t) i * 480, qpc - 100000);
+    recorded += 2;
+  }
+  CHECK(writer.IsTruncated());
+  CHECK(writer.EventBytes() <= 256);
+
+  // Recording stops at the first event that might not fit; everything before it decodes.
+  std::vector<uint8_t> bytes;
+  writer.Serialize(bytes);
+  bool clean = false;
+  std::vector<PacketTraceEvent> events = ReadAll(bytes, clean);
+  CHECK(clean);
+  CHECK(events.size() > 10 && (int) events.size() < recorded);
+  PacketTraceReader reader;
+  CHECK(reader.Open(bytes.data(), bytes.size()));
+  CHECK(reader.IsTruncated());
+  for (size_t i = 0; i < events.size(); ++i) {
+    CHECK(events[i].type == ((i % 2 == 0) ? PacketTraceEvent::Type::Wakeup : PacketTraceEvent::Type::Packet));
+    CHECK_EQ(10000000u + (i / 2) * 100000 - ((i % 2) ? 100000u : 0u), events[i].qpc);
+  }
+}
+
+static void TestDamagedTraces() {
+  PacketTraceWriter writer(4096, TestFormat());
+  writer.RecordWakeup(50000000, 960);
+  writer.RecordPacket(480, 0, 0, 49900000);
+  std::vector<uint8_t> bytes;
+  writer.Serialize(bytes);
+  PacketTraceReader reader;
+
+  CHECK(!reader.Open(bytes.data(), 10)); // shorter than the header
+  std::vector<uint8_t> damaged = bytes;
+  damaged[0] = 'X';
+  CHECK(!reader.Open(damaged.data(), damaged.size()));
+  damaged = bytes;
+  damaged[4] = 2; // a future version
+  CHECK(!reader.Open(damaged.data(), damaged.size()));
+  // Cut off in the middle of the events: the header claims more than is there.
+  CHECK(!reader.Open(bytes.data(), bytes.size() - 1));
+
+  // An unknown tag or a varint running off the end stops reading.
+  damaged = bytes;
+  damaged[damaged.size() - writer.EventBytes()] = 0x7f;
+  bool clean = false;
+  CHECK(ReadAll(damaged, clean).empty());
+  damaged = bytes;
+  damaged.back() |= 0x80;
+  std::vector<PacketTraceEvent> events = ReadAll(damaged, clean);
+  CHECK_EQ((size_t) 1, events.size());
+}
+
+static void TestCompactness() {
+  // An hour of a 10 ms route: one wakeup and one packet every 10 ms, with a little timing jitter.
+  const int kWakeups = 360000;
+  PacketTraceWriter writer(16 << 20, TestFormat());
+  uint64_t qpc = 10000000;
+  uint32_t random = 1;
+  for (int i = 0; i < kWakeups; ++i) {
+    random = random * 1664525u + 1013904223u;
+    uint64_t jitter = (random >> 8) % 20000; // up to 2 ms late
+    writer.RecordWakeup(qpc + jitter, 960 - (uint32_t) (jitter / 2083));
+    writer.RecordPacket(480, 0, (uint64_t) i * 480, qpc - 100000);
+    qpc += 100000;
+  }
+  CHECK(!writer.IsTruncated());
+  double bytesPerEvent = (double) writer.EventBytes() / (2.0 * kWakeups);
+  printf("packet trace: %.2f MB per hour of 10 ms wakeups, %.2f bytes per event\n",
+    (double) writer.EventBytes() / (1024.0 * 1024.0), bytesPerEvent);
+  CHECK(bytesPerEvent < 8.0); // out of a worst case of 41
+}
+
+int main() {
+  TestRoundTrip();
+  TestTruncation();
+  TestDamagedTraces();
+  TestCompactness();
+  return CheckResult();
+}
@@ -0,0 +1,257 @@
+#include "Check.h"
+#include "QosPolicy.h"
+#include "ReplayBuffer.h"
+#include "RoutePipeline.h"
+#include "RouteStats.h"
+
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+// Unit tests for the shed/restore rules, and a CPU-pressure benchmark that times the routing
+// pipeline at each level, then runs the same load at those costs through a route with and without
+// the policy and compares glitch counts.
+
+static void TestSingleMissDoesNotShed() {
+  QosPolicy policy;
+  for (int i = 0; i < 1000; ++i) {
+    // A healthy route with an occasional very late callback (preempted, page fault).
+    uint32_t usage = (i % 100 == 50) ? 1000 : 30;
+    CHECK(!policy.Update(usage));
+  }
+  CHECK(policy.Level() == QosLevel::Full);
+}
+
+static void TestSustainedPressureShedsStepByStep() {
+  QosPolicy policy;
+  int changes = 0;
+  int firstShed = -1;
+  for (int i = 0; i < 1000; ++i) {
+    if (policy.Update(90)) {
+      changes++;
+      if (firstShed < 0)
+        firstShed = i;
+    }
+  }
+  // Stops at the last optional stage; gain is never shed.
+  CHECK(policy.Level() == QosLevel::FastConversion);
+  CHECK_EQ(3, changes);
+  // The average has to climb past the threshold first.
+  CHECK(firstShed >= 8);
+}
+
+static void TestRestoresAfterHeadroomReturns() {
+  QosPolicy policy;
+  for (int i = 0; i < 200; ++i)
+    policy.Update(90);
+  CHECK(policy.Level() == QosLevel::FastConversion);
+
+  // Usage between the thresholds holds the current level.
+  for (int i = 0; i < 1000; ++i)
+    policy.Update(60);
+  CHECK(policy.Level() == QosLevel::FastConversion);
+
+  int callbacks = 0;
+  while (policy.Level() != QosLevel::Full && callbacks < 10000) {
+    policy.Update(20);
+    callbacks++;
+  }
+  CHECK(policy.Level() == QosLevel::Full);
+  CHECK(callbacks >= 2 * (int) QosPolicy::kRestoreHoldoff);
+}
+
+static void TestFailedRestoreBacksOff() {
+  // A host that leaves room for everything but the replay history: at NoHistory the usage looks
+  // like plenty of headroom, but restoring the history overruns every time.
+  QosPolicy policy;
+  auto usageAt = [](QosLevel level) -> uint32_t { return (level < QosLevel::NoHistory) ? 120 : 30; };
+  int restores = 0;
+  for (int i = 0; i < 5000; ++i) {
+    QosLevel level = policy.Level();
+    if (policy.Update(usageAt(level)) && policy.Level() < level)
+      restores++;
+  }
+  // Without the backoff it would be retried every kRestoreHoldoff or so callbacks, about 20 times.
+  CHECK(restores >= 2 && restores <= 5);
+  CHECK(policy.RestoreHoldoff() > QosPolicy::kRestoreHoldoff);
+  CHECK(policy.RestoreHoldoff() <= QosPolicy::kMaxRestoreHoldoff);
+
+  // Once the pressure is gone everything comes back, and a restore that holds resets the backoff.
+  int callbacks = 0;
+  while (policy.Level() != QosLevel::Full && callbacks < 20000) {
+    policy.Update(20);
+    callbacks++;
+  }
+  CHECK(policy.Level() == QosLevel::Full);
+  for (int i = 0; i < (int) QosPolicy::kRestoreProbation; ++i)
+    policy.Update(20);
+  CHECK_EQ(QosPolicy::kRestoreHoldoff, policy.RestoreHoldoff());
+}
+
+// Deterministic pseudo-random jitter, so the benchmark gives the same counts on every run.
+static uint32_t NextRandom(uint32_t& state) {
+  state = state * 1664525u + 1013904223u;
+  return state >> 8;
+}
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kChannels = 2;
+static const uint32_t kPacketFrames = 480; // one 10 ms callback
+static const uint32_t kLevels = static_cast<uint32_t>(QosLevel::FastConversion) + 1;
+
+// Render queue that takes every packet, into a buffer allocated up front.
+class DiscardingRenderQueue : public RenderTarget {
+public:
+  DiscardingRenderQueue() : m_buffer(kPacketFrames * kChannels * sizeof(float)) {}
+
+  RenderStatus GetBuffer(uint32_t, uint8_t** buffer) override {
+    *buffer = m_buffer.data();
+    return RenderStatus::Ok;
+  }
+
+  void ReleaseBuffer(uint32_t, bool) override {}
+
+private:
+  std::vector<uint8_t> m_buffer;
+};
+
+//
+//  MeasureCallbackCosts()
+//
+//  Times RoutePipeline::Process() on one callback's worth of audio at each QosLevel, with every
+//  optional stage in use: gain, metering, a replay history and dithered conversion to a 16-bit
+//  exclusive-mode device. Each level's cost is the best average of several runs, in nanoseconds.
+//
+static void MeasureCallbackCosts(double costNs[kLevels]) {
+  const int kCallbacks = 2000;
+  const int kRuns = 5;
+  RouteStats stats;
+  RoutePipeline pipeline(stats);
+  ReplayBuffer replay(kSampleRate, kChannels, 60);
+  DiscardingRenderQueue render;
+  std::vector<float> processBuffer(kPacketFrames * kChannels);
+  std::vector<float> captured(kPacketFrames * kChannels);
+  for (uint32_t i = 0; i < captured.size(); ++i)
+    captured[i] = 0.25f * sinf((float) (i / kChannels) * 0.0576f);
+
+  RouteWakeup wakeup;
+  wakeup.sampleRate = kSampleRate;
+  wakeup.channels = kChannels;
+  wakeup.blockAlign = kChannels * sizeof(float);
+  wakeup.isFloat = true;
+  wakeup.processBuffer = processBuffer.data();
+  wakeup.processBufferFrames = kPacketFrames;
+  wakeup.gain = 0.7f;
+  wakeup.replay = &replay;
+  wakeup.render = &render;
+  wakeup.exclusive = true;
+  wakeup.renderFormat.sampleRate = kSampleRate;
+  wakeup.renderFormat.channels = kChannels;
+  wakeup.renderFormat.sampleType = PcmSampleType::Int16;
+
+  RoutePacket packet;
+  packet.data = reinterpret_cast<const uint8_t*>(captured.data());
+  packet.frames = kPacketFrames;
+  // Fill the history once first, so no level is charged for touching its memory the first time.
+  for (uint32_t i = 0; i < 60 * kSampleRate / kPacketFrames; ++i)
+    pipeline.Process(wakeup, packet);
+
+  // Levels take turns, so a busy moment on the machine doesn't land on one of them.
+  for (uint32_t level = 0; level < kLevels; ++level)
+    costNs[level] = 1e18;
+  for (int run = 0; run < kRuns; ++run) {
+    for (uint32_t level = 0; level < kLevels; ++level) {
+      wakeup.qosLevel = static_cast<QosLevel>(level);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < kCallbacks; ++i)
+        pipeline.Process(wakeup, packet);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / kCallbacks;
+      costNs[level] = (ns < costNs[level]) ? ns : costNs[level];
+    }
+  }
+}
+
+struct PressureResult {
+  uint32_t glitches = 0;
+  uint32_t glitchesUnderPressure = 0;
+  uint32_t sheds = 0;
+  QosLevel deepestLevel = QosLevel::Full;
+  QosLevel finalLevel = QosLevel::Full;
+};
+
+//
+//  RunPressureBenchmark()
+//
+//  Simulates a route's callbacks through idle, saturated and idle phases of a host game, costing
+//  each callback at its level's measured cost. The deadline is scaled so that the costliest level
+//  (the full pipeline, give or take timing noise) uses kIdleUsagePercent of it on an idle machine;
+//  under pressure the host takes a share of the CPU, which stretches every callback by a jittered
+//  factor. A callback at or over 100% is a glitch.
+//
+static PressureResult RunPressureBenchmark(const double costNs[kLevels], bool qosEnabled) {
+  const double kIdleUsagePercent = 30.0;
+  const int kIdleCallbacks = 3000;
+  const int kPressureCallbacks = 3000;
+  double costliestNs = 0.0;
+  for (uint32_t level = 0; level < kLevels; ++level)
+    costliestNs = (costNs[level] > costliestNs) ? costNs[level] : costliestNs;
+  double deadlineNs = costliestNs * 100.0 / kIdleUsagePercent;
+
+  QosPolicy policy;
+  PressureResult result;
+  uint32_t random = 1;
+  for (int i = 0; i < kIdleCallbacks + kPressureCallbacks + kIdleCallbacks; ++i) {
+    bool pressure = (i >= kIdleCallbacks && i < kIdleCallbacks + kPressureCallbacks);
+    // Stretch factor in hundredths: 1.0-1.1x idle, 3.4-4.2x while the host saturates the CPU.
+    uint32_t stretch = pressure ? 340 + NextRandom(random) % 81 : 100 + NextRandom(random) % 11;
+
+    QosLevel level = policy.Level();
+    uint32_t usagePercent = (uint32_t) (costNs[static_cast<uint32_t>(level)] * stretch / deadlineNs);
+
+    if (usagePercent >= 100) {
+      result.glitches++;
+      if (pressure)
+        result.glitchesUnderPressure++;
+    }
+    if (qosEnabled) {
+      if (policy.Update(usagePercent) && policy.Level() > level)
+        result.sheds++;
+      if (policy.Level() > result.deepestLevel)
+        result.deepestLevel = policy.Level();
+    }
+  }
+  result.finalLevel = policy.Level();
+  return result;
+}
+
+static void TestPressureBenchmark() {
+  double costNs[kLevels];
+  MeasureCallbackCosts(costNs);
+  printf("measured cost of a 10 ms callback: full %.1f us, no metering %.1f us, no history %.1f us, fast conversion %.1f us\n",
+    costNs[0] / 1000, costNs[1] / 1000, costNs[2] / 1000, costNs[3] / 1000);
+  // Shedding the history saves the most: the replay encoder is the costliest optional stage.
+  CHECK(costNs[static_cast<uint32_t>(QosLevel::NoHistory)] < 0.8 * costNs[static_cast<uint32_t>(QosLevel::NoMetering)]);
+  CHECK(costNs[kLevels - 1] < 0.6 * costNs[0]);
+
+  PressureResult without = RunPressureBenchmark(costNs, false);
+  PressureResult with = RunPressureBenchmark(costNs, true);
+  printf("CPU pressure at measured costs, 9000 callbacks (3000 under pressure): %u glitches without QoS, %u with QoS "
+    "(%u sheds, deepest level %u)\n", without.glitches, with.glitches, with.sheds, static_cast<uint32_t>(with.deepestLevel));
+
+  // Without the policy the full pipeline can't keep up for the whole saturated phase.
+  CHECK(without.glitchesUnderPressure > 2500);
+  // With it, only the callbacks before the average catches up glitch.
+  CHECK(with.glitches * 10 < without.glitches);
+  CHECK(with.deepestLevel >= QosLevel::NoHistory);
+  // Everything is back on once the host calms down.
+  CHECK(with.finalLevel == QosLevel::Full);
+}
+
+int main() {
+  TestSingleMissDoesNotShed();
+  TestSustainedPressureShedsStepByStep();
+  TestRestoresAfterHeadroomReturns();
+  TestFailedRestoreBacksOff();
+  TestPressureBenchmark();
+  return CheckResult();
+}
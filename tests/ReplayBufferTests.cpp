@@ -0,0 +1,267 @@
+#include "Check.h"
+#include "ReplayBuffer.h"
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// The instant-replay history: snapshots are valid IMA ADPCM WAV files that a standard decoder
+// (written out here independently of the encoder) turns back into the audio that was appended,
+// they hold what was asked for and no more than was kept, and a snapshot taken while the writer
+// runs never includes a block it overwrote. Also reports the memory and encoding cost.
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kChannels = 2;
+
+struct WavFile {
+  uint16_t formatTag = 0;
+  uint16_t channels = 0;
+  uint32_t sampleRate = 0;
+  uint16_t blockAlign = 0;
+  uint16_t samplesPerBlock = 0;
+  uint32_t factFrames = 0;
+  const uint8_t* data = nullptr;
+  uint32_t dataBytes = 0;
+};
+
+static uint16_t GetU16(const uint8_t* src) {
+  return (uint16_t) (src[0] | (src[1] << 8));
+}
+
+static uint32_t GetU32(const uint8_t* src) {
+  return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+static bool ParseWav(const std::vector<uint8_t>& file, WavFile& wav) {
+  if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) != 0 || memcmp(file.data() + 8, "WAVE", 4) != 0 ||
+      GetU32(file.data() + 4) != file.size() - 8)
+    return false;
+  size_t offset = 12;
+  while (offset + 8 <= file.size()) {
+    const uint8_t* chunk = file.data() + offset;
+    uint32_t size = GetU32(chunk + 4);
+    if (offset + 8 + size > file.size())
+      return false;
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 20) {
+      wav.formatTag = GetU16(chunk + 8);
+      wav.channels = GetU16(chunk + 10);
+      wav.sampleRate = GetU32(chunk + 12);
+      wav.blockAlign = GetU16(chunk + 20);
+      wav.samplesPerBlock = GetU16(chunk + 26);
+    } else if (memcmp(chunk, "fact", 4) == 0 && size >= 4) {
+      wav.factFrames = GetU32(chunk + 8);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      wav.data = chunk + 8;
+      wav.dataBytes = size;
+    }
+    offset += 8 + size;
+  }
+  return wav.data != nullptr && wav.blockAlign != 0;
+}
+
+// Microsoft IMA ADPCM, as a player would decode it.
+static std::vector<int16_t> DecodeImaAdpcm(const WavFile& wav) {
+  static const int32_t stepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73,
+    80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
+    544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+    2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+  };
+  static const int32_t indexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+  std::vector<int16_t> pcm;
+  for (uint32_t offset = 0; offset + wav.blockAlign <= wav.dataBytes; offset += wav.blockAlign) {
+    const uint8_t* block = wav.data + offset;
+    size_t blockStart = pcm.size();
+    pcm.resize(blockStart + (size_t) wav.samplesPerBlock * wav.channels);
+    int16_t* out = &pcm[blockStart];
+
+    std::vector<int32_t> predictor(wav.channels), stepIndex(wav.channels);
+    for (uint32_t ch = 0; ch < wav.channels; ++ch) {
+      predictor[ch] = (int16_t) GetU16(block + ch * 4);
+      stepIndex[ch] = block[ch * 4 + 2];
+      out[ch] = (int16_t) predictor[ch];
+    }
+    const uint8_t* codes = block + wav.channels * 4;
+    for (uint32_t frame = 1; frame < wav.samplesPerBlock; frame += 8) {
+      for (uint32_t ch = 0; ch < wav.channels; ++ch) {
+        for (uint32_t i = 0; i < 8; ++i) {
+          uint8_t nibble = (codes[i / 2] >> ((i % 2) * 4)) & 0xf;
+          int32_t step = stepTable[stepIndex[ch]];
+          int32_t delta = (step >> 3) + ((nibble & 4) ? step : 0) + ((nibble & 2) ? step >> 1 : 0) + ((nibble & 1) ? step >> 2 : 0);
+          predictor[ch] += (nibble & 8) ? -delta : delta;
+          predictor[ch] = (predictor[ch] > 32767) ? 32767 : ((predictor[ch] < -32768) ? -32768 : predictor[ch]);
+          stepIndex[ch] += indexTable[nibble];
+          stepIndex[ch] = (stepIndex[ch] > 88) ? 88 : ((stepIndex[ch] < 0) ? 0 : stepIndex[ch]);
+          out[(frame + i) * wav.channels + ch] = (int16_t) predictor[ch];
+        }
+        codes += 4;
+      }
+    }
+  }
+  return pcm;
+}
+
+// A tone that differs per channel, so a channel mix-up shows.
+static float ToneSample(uint64_t frame, uint32_t channel) {
+  float frequency = (channel == 0) ? 440.0f : 1000.0f;
+  return 0.5f * sinf(2.0f * 3.14159265f * frequency * (float) frame / kSampleRate);
+}
+
+static void AppendTone(ReplayBuffer& replay, uint64_t& frame, uint32_t frames) {
+  std::vector<float> samples(frames * kChannels);
+  for (uint32_t i = 0; i < frames; ++i) {
+    for (uint32_t ch = 0; ch < kChannels; ++ch)
+      samples[i * kChannels + ch] = ToneSample(frame + i, ch);
+  }
+  replay.Append(samples.data(), frames);
+  frame += frames;
+}
+
+static void TestDecodesToWhatWasAppended() {
+  ReplayBuffer replay(kSampleRate, kChannels, 10);
+  std::vector<uint8_t> file;
+  CHECK(!replay.Snapshot(10, file)); // nothing recorded yet
+
+  // Three seconds in packet-sized pieces that don't line up with ADPCM blocks.
+  uint64_t frame = 0;
+  while (frame < 3 * kSampleRate)
+    AppendTone(replay, frame, 441);
+
+  CHECK(replay.Snapshot(10, file));
+  WavFile wav;
+  CHECK(ParseWav(file, wav));
+  CHECK_EQ(0x0011, wav.formatTag);
+  CHECK_EQ(kChannels, wav.channels);
+  CHECK_EQ(kSampleRate, wav.sampleRate);
+  CHECK_EQ(0u, wav.dataBytes % wav.blockAlign);
+  CHECK_EQ((wav.dataBytes / wav.blockAlign) * wav.samplesPerBlock, wav.factFrames);
+  CHECK_EQ(replay.BlocksEncoded(), (uint64_t) (wav.dataBytes / wav.blockAlign));
+
+  // Every complete block is there from the start, so decoded frame n is appended frame n.
+  std::vector<int16_t> pcm = DecodeImaAdpcm(wav);
+  CHECK_EQ((size_t) wav.factFrames * kChannels, pcm.size());
+  double signal = 0.0, noise = 0.0;
+  for (size_t i = 0; i < pcm.size(); ++i) {
+    double expected = ToneSample(i / kChannels, i % kChannels) * 32768.0;
+    signal += expected * expected;
+    noise += (pcm[i] - expected) * (pcm[i] - expected);
+  }
+  double snrDb = 10.0 * log10(signal / noise);
+  printf("replay: %u frames decoded at %.1f dB SNR\n", wav.factFrames, snrDb);
+  CHECK(snrDb > 25.0);
+}
+
+static void TestSilence() {
+  ReplayBuffer replay(kSampleRate, kChannels, 10);
+  replay.AppendSilence(kSampleRate);
+  std::vector<uint8_t> file;
+  CHECK(replay.Snapshot(1, file));
+  WavFile wav;
+  CHECK(ParseWav(file, wav));
+  std::vector<int16_t> pcm = DecodeImaAdpcm(wav);
+  bool silent = !pcm.empty();
+  for (int16_t sample : pcm)
+    silent &= (sample == 0);
+  CHECK(silent);
+}
+
+static void TestHoldsOnlyWhatWasAsked() {
+  ReplayBuffer replay(kSampleRate, kChannels, 10);
+  uint64_t frame = 0;
+  while (frame < 30 * kSampleRate)
+    AppendTone(replay, frame, 4800);
+  // Rounded to whole blocks, and never more than was asked to be kept.
+  CHECK(replay.SecondsHeld() >= 9 && replay.SecondsHeld() <= 10);
+
+  std::vector<uint8_t> file;
+  WavFile wav;
+  CHECK(replay.Snapshot(3, file));
+  CHECK(ParseWav(file, wav));
+  CHECK(wav.factFrames >= 3 * kSampleRate && wav.factFrames < 3 * kSampleRate + wav.samplesPerBlock);
+
+  CHECK(replay.Snapshot(60, file));
+  CHECK(ParseWav(file, wav));
+  CHECK(wav.factFrames >= 9 * kSampleRate && wav.factFrames <= 10 * kSampleRate + wav.samplesPerBlock);
+  CHECK((size_t) wav.dataBytes < replay.MemoryBytes());
+}
+
+static void TestSnapshotWhileRecording() {
+  // Each block holds a constant equal to its index, which the block header carries verbatim, so a
+  // snapshot shows exactly which blocks it got. A small history makes the writer lap the reader.
+  ReplayBuffer replay(kSampleRate, 1, 1);
+  const uint32_t kBlocks = 20000;
+  std::atomic<bool> done{ false };
+  std::thread writer([&]() {
+    std::vector<float> block;
+    for (uint32_t index = 0; index < kBlocks; ++index) {
+      uint32_t samplesPerBlock = (512 - 4) * 2 + 1;
+      block.assign(samplesPerBlock, (float) (index % 32000) / 32768.0f);
+      replay.Append(block.data(), samplesPerBlock);
+    }
+    done = true;
+  });
+
+  uint32_t snapshots = 0, inconsistent = 0;
+  std::vector<uint8_t> file;
+  while (!done.load()) {
+    if (!replay.Snapshot(1, file))
+      continue;
+    WavFile wav;
+    if (!ParseWav(file, wav) || wav.dataBytes == 0) {
+      inconsistent++;
+      continue;
+    }
+    snapshots++;
+    int16_t previous = (int16_t) GetU16(wav.data);
+    for (uint32_t offset = wav.blockAlign; offset < wav.dataBytes; offset += wav.blockAlign) {
+      int16_t index = (int16_t) GetU16(wav.data + offset);
+      if (index != (previous + 1) % 32000)
+        inconsistent++;
+      previous = index;
+    }
+  }
+  writer.join();
+  printf("replay: %u snapshots taken while recording\n", snapshots);
+  CHECK(snapshots > 0);
+  CHECK_EQ(0u, inconsistent);
+}
+
+static void TestCost() {
+  ReplayBuffer replay(kSampleRate, kChannels, 60);
+  double megabytesPerMinute = replay.BytesPerMinute() / 1e6;
+  CHECK(megabytesPerMinute > 2.8 && megabytesPerMinute < 3.0);
+  CHECK(replay.MemoryBytes() >= replay.BytesPerMinute());
+  CHECK(replay.MemoryBytes() < replay.BytesPerMinute() + 4096);
+
+  // A minute of audio in 10 ms packets, as the audio thread would append it.
+  const uint32_t kPacketFrames = kSampleRate / 100;
+  std::vector<float> packet(kPacketFrames * kChannels);
+  for (uint32_t i = 0; i < kPacketFrames; ++i) {
+    for (uint32_t ch = 0; ch < kChannels; ++ch)
+      packet[i * kChannels + ch] = ToneSample(i, ch);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 6000; ++i)
+    replay.Append(packet.data(), kPacketFrames);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("replay: %.2f MB per minute of %u Hz stereo; encoding costs %.2f us per 10 ms packet (%.3f%% of one core)\n",
+    megabytesPerMinute, kSampleRate, seconds * 1e6 / 6000, seconds * 100.0 / 60.0);
+  CHECK(replay.SecondsHeld() >= 59);
+  // Generous, for unoptimized builds on a loaded machine: well under a tenth of real time.
+  CHECK(seconds < 6.0);
+}
+
+int main() {
+  TestDecodesToWhatWasAppended();
+  TestSilence();
+  TestHoldsOnlyWhatWasAsked();
+  TestSnapshotWhileRecording();
+  TestCost();
+  return CheckResult();
+}
@@ -0,0 +1,120 @@
+#include "Check.h"
+#include "RouteSpec.h"
+
+static void TestPid() {
+  RouteSource source;
+  CHECK(ParseRouteSource(L"1234", 42, source));
+  CHECK(source.mode == RouteSource::Mode::IncludeProcessTree);
+  CHECK_EQ(1234u, source.pid);
+  CHECK(source.imageName.empty());
+  CHECK(!source.matchesByName());
+}
+
+static void TestImageName() {
+  RouteSource source;
+  CHECK(ParseRouteSource(L"vlc.exe", 42, source));
+  CHECK(source.mode == RouteSource::Mode::IncludeProcessTree);
+  CHECK_EQ(0u, source.pid);
+  CHECK(source.imageName == L"vlc.exe");
+  CHECK(source.matchesByName());
+
+  // Leading digits don't make a PID.
+  CHECK(ParseRouteSource(L"7zip.exe", 42, source));
+  CHECK(source.imageName == L"7zip.exe");
+  CHECK(source.matchesByName());
+
+  // Neither does PID 0 (the idle process).
+  CHECK(ParseRouteSource(L"0", 42, source));
+  CHECK(source.matchesByName());
+}
+
+static void TestExcludeHost() {
+  RouteSource source;
+  CHECK(ParseRouteSource(L"*", 42, source));
+  CHECK(source.mode == RouteSource::Mode::ExcludeProcessTree);
+  CHECK_EQ(42u, source.pid);
+  CHECK(source.imageName.empty());
+}
+
+static void TestEmpty() {
+  RouteSource source;
+  source.pid = 7;
+  CHECK(!ParseRouteSource(L"", 42, source));
+  CHECK(!ParseRouteSource(nullptr, 42, source));
+  // A failed parse doesn't leave the previous route behind.
+  CHECK_EQ(0u, source.pid);
+}
+
+static void TestControlCommands() {
+  std::wstring verb, argument;
+  SplitControlCommand(L"gain   -6", verb, argument);
+  CHECK(verb == L"gain");
+  CHECK(argument == L"-6");
+  SplitControlCommand(L"status", verb, argument);
+  CHECK(verb == L"status");
+  CHECK(argument.empty());
+  SplitControlCommand(L"replay save 30 C:\\My Clips\\a.wav", verb, argument);
+  CHECK(argument == L"save 30 C:\\My Clips\\a.wav");
+
+  float gainDb = 1.0f;
+  CHECK(ParseGainDb(L"-6.5", gainDb));
+  CHECK(gainDb == -6.5f);
+  CHECK(ParseGainDb(L"24", gainDb));
+  gainDb = 1.0f;
+  CHECK(!ParseGainDb(L"", gainDb));
+  CHECK(!ParseGainDb(L"25", gainDb));
+  CHECK(!ParseGainDb(L"-97", gainDb));
+  CHECK(!ParseGainDb(L"3dB", gainDb));
+  CHECK(gainDb == 1.0f);
+
+  uint32_t bufferMs = 7;
+  CHECK(ParseRenderBufferMs(L"40", bufferMs));
+  CHECK_EQ(40u, bufferMs);
+  CHECK(!ParseRenderBufferMs(L"0", bufferMs));
+  CHECK(!ParseRenderBufferMs(L"2001", bufferMs));
+  CHECK(!ParseRenderBufferMs(L"40ms", bufferMs));
+  CHECK_EQ(40u, bufferMs);
+}
+
+static void TestStreamDestination() {
+  std::wstring host, port;
+  CHECK(ParseStreamDestination(L"studio-pc:5004", host, port));
+  CHECK(host == L"studio-pc");
+  CHECK(port == L"5004");
+  CHECK(ParseStreamDestination(L"192.168.1.20:65535", host, port));
+  CHECK(host == L"192.168.1.20");
+
+  // IPv6 addresses are bracketed, and the brackets aren't part of the host.
+  CHECK(ParseStreamDestination(L"[::1]:5004", host, port));
+  CHECK(host == L"::1");
+  CHECK(port == L"5004");
+  CHECK(ParseStreamDestination(L"[fe80::1%12]:6000", host, port));
+  CHECK(host == L"fe80::1%12");
+  CHECK(port == L"6000");
+
+  host = L"unchanged";
+  CHECK(!ParseStreamDestination(L"::1:5004", host, port)); // ambiguous without brackets
+  CHECK(!ParseStreamDestination(L"[::1]5004", host, port));
+  CHECK(!ParseStreamDestination(L"[::1:5004", host, port));
+  CHECK(!ParseStreamDestination(L"[]:5004", host, port));
+  CHECK(!ParseStreamDestination(L"[::1]:", host, port));
+  CHECK(!ParseStreamDestination(L":5004", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc:", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc:0", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc:65536", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc:-1", host, port));
+  CHECK(!ParseStreamDestination(L"studio-pc:rtp", host, port));
+  CHECK(!ParseStreamDestination(L"", host, port));
+  CHECK(host == L"unchanged");
+}
+
+int main() {
+  TestPid();
+  TestImageName();
+  TestExcludeHost();
+  TestEmpty();
+  TestControlCommands();
+  TestStreamDestination();
+  return CheckResult();
+}
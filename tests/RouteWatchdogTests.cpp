@@ -0,0 +1,252 @@
+#include "Check.h"
+#include "RouteSpec.h"
+#include "RouteStats.h"
+#include "RouteWatchdog.h"
+
+// Fault injection against a synthetic route: the watchdog notices each kind of failure the
+// `fault` control command raises, rebuilds only the side that failed, gets the route going again
+// within the recovery target, leaves a quiet source alone, and backs off from a device that won't
+// come back. Runs on a simulated clock, so the timings are exact.
+
+static uint64_t g_now = 0; // 100ns
+
+static uint64_t FakeClock() {
+  return g_now;
+}
+
+static const uint64_t kMs = 10000;
+// How long the fake device takes to reopen, like a real one that is slow to come back.
+static const uint64_t kRenderOpenTime = 40 * kMs;
+static const uint64_t kCaptureActivateTime = 30 * kMs;
+
+enum class Fault { Capture, Render, Stall };
+
+// A route as the watchdog sees it, driven a millisecond at a time: the audio thread wakes on its
+// own schedule and reports what it finds, and the router thread runs the watchdog every
+// kCheckIntervalMs. Rebuilds take simulated time.
+class FakeRoute : public WatchdogBackend {
+public:
+  FakeRoute(RouteStats& stats, uint32_t wakeupMs, uint32_t toleranceMs) :
+    m_watchdog(stats, FakeClock), m_wakeupPeriod(wakeupMs * kMs), m_tolerance(toleranceMs * kMs) {
+    g_now = 1000 * kMs;
+    m_watchdog.SetWakeupPeriod(m_wakeupPeriod, m_tolerance);
+    m_watchdog.NoteWakeup();
+    m_nextWakeup = g_now + m_wakeupPeriod;
+    m_nextCheck = g_now + RouteWatchdog::kCheckIntervalMs * kMs;
+  }
+
+  // Raised the way InjectFault() raises it: capture and render faults at the next wakeup, a
+  // stall straight away.
+  void Inject(Fault fault) {
+    m_faultTime = g_now;
+    m_recoveredTime = 0;
+    if (fault == Fault::Stall)
+      m_stalled = true;
+    else
+      m_pendingFault = fault;
+    m_hasPendingFault = (fault != Fault::Stall);
+  }
+
+  void Run(uint32_t ms) {
+    uint64_t end = g_now + ms * kMs;
+    while (g_now < end) {
+      g_now += kMs;
+      if (g_now >= m_nextWakeup)
+        Wakeup();
+      if (g_now >= m_nextCheck) {
+        m_watchdog.Check(*this);
+        m_nextCheck = g_now + RouteWatchdog::kCheckIntervalMs * kMs;
+      }
+    }
+  }
+
+  // From the fault being raised to the failed side running again, or 0 if it hasn't.
+  uint64_t RecoveryMs() const { return m_recoveredTime ? (m_recoveredTime - m_faultTime) / kMs : 0; }
+
+  bool sourcePlaying = true;    // the engine has audio for the capture stream
+  bool eventDriven = true;      // wakeups come from the engine, so stop when the source is quiet
+  uint32_t failingRebuilds = 0; // how many rebuilds in a row fail before the device comes back
+  bool renderFormatChanges = false;
+  uint32_t captureRebuilds = 0;
+  uint32_t renderRebuilds = 0;
+
+  bool CaptureFailed() override { return m_captureErrored; }
+  bool CaptureHasQueuedData() override { return sourcePlaying && !m_captureErrored; }
+
+  RebuildStatus RebuildRender() override {
+    g_now += kRenderOpenTime;
+    if (failingRebuilds > 0) {
+      failingRebuilds--;
+      return RebuildStatus::Failed;
+    }
+    renderRebuilds++;
+    m_renderBroken = false;
+    if (renderFormatChanges)
+      return RebuildStatus::FormatChanged;
+    m_recoveredTime = g_now;
+    return RebuildStatus::Ok;
+  }
+
+  bool RebuildCapture() override {
+    g_now += kCaptureActivateTime;
+    if (failingRebuilds > 0) {
+      failingRebuilds--;
+      return false;
+    }
+    captureRebuilds++;
+    m_captureErrored = false;
+    m_stalled = false;
+    m_nextWakeup = g_now + m_wakeupPeriod;
+    m_recoveredTime = g_now;
+    return true;
+  }
+
+private:
+  void Wakeup() {
+    m_nextWakeup += m_wakeupPeriod + (m_tolerance ? (m_lateness++ * 7 * kMs) % (m_tolerance + kMs) : 0);
+    if (m_captureErrored || m_stalled || (eventDriven && !sourcePlaying))
+      return;
+    m_watchdog.NoteWakeup();
+    if (m_hasPendingFault) {
+      m_hasPendingFault = false;
+      if (m_pendingFault == Fault::Capture) {
+        m_captureErrored = true; // OnSampleReady() gives up
+        return;
+      }
+      m_renderBroken = true;
+    }
+    if (m_renderBroken && !m_watchdog.RenderFaulted())
+      m_watchdog.NoteRenderFault(); // GetBuffer() failed
+  }
+
+  RouteWatchdog m_watchdog;
+  uint64_t m_wakeupPeriod;
+  uint64_t m_tolerance;
+  uint64_t m_nextWakeup = 0;
+  uint64_t m_nextCheck = 0;
+  uint32_t m_lateness = 0;
+  bool m_captureErrored = false;
+  bool m_stalled = false;
+  bool m_renderBroken = false;
+  bool m_hasPendingFault = false;
+  Fault m_pendingFault = Fault::Capture;
+  uint64_t m_faultTime = 0;
+  uint64_t m_recoveredTime = 0;
+};
+
+static const uint64_t kRecoveryTargetMs = 100;
+
+static void TestCaptureFault() {
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.Run(500);
+  CHECK_EQ(0u, route.captureRebuilds + route.renderRebuilds); // a healthy route is left alone
+  route.Inject(Fault::Capture);
+  route.Run(500);
+  printf("capture fault: recovered in %llu ms\n", (unsigned long long) route.RecoveryMs());
+  CHECK_EQ(1u, route.captureRebuilds);
+  CHECK_EQ(0u, route.renderRebuilds);
+  CHECK(route.RecoveryMs() > 0 && route.RecoveryMs() < kRecoveryTargetMs);
+  CHECK_EQ(1u, stats.captureRecoveries.load());
+  CHECK(stats.lastRecoveryMs.load() < kRecoveryTargetMs);
+}
+
+static void TestRenderFault() {
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.Run(500);
+  route.Inject(Fault::Render);
+  route.Run(500);
+  printf("render fault: recovered in %llu ms\n", (unsigned long long) route.RecoveryMs());
+  CHECK_EQ(0u, route.captureRebuilds); // capture kept running
+  CHECK_EQ(1u, route.renderRebuilds);
+  CHECK(route.RecoveryMs() > 0 && route.RecoveryMs() < kRecoveryTargetMs);
+  CHECK_EQ(1u, stats.renderRecoveries.load());
+  CHECK_EQ(0u, stats.captureRecoveries.load());
+}
+
+static void TestRenderFormatChange() {
+  // The new render device wants a different mix format, so capture is rebuilt to feed it.
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.renderFormatChanges = true;
+  route.Run(500);
+  route.Inject(Fault::Render);
+  route.Run(500);
+  CHECK_EQ(1u, route.renderRebuilds);
+  CHECK_EQ(1u, route.captureRebuilds);
+  CHECK(route.RecoveryMs() > 0 && route.RecoveryMs() < kRecoveryTargetMs);
+}
+
+static void TestStall() {
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.Run(500);
+  route.Inject(Fault::Stall);
+  route.Run(500);
+  printf("capture stall: recovered in %llu ms (stall threshold %llu ms)\n", (unsigned long long) route.RecoveryMs(),
+    (unsigned long long) (10 * kMs + RouteWatchdog::kStallMargin) / kMs);
+  CHECK_EQ(1u, route.captureRebuilds);
+  CHECK_EQ(0u, route.renderRebuilds);
+  CHECK(route.RecoveryMs() > 0 && route.RecoveryMs() < kRecoveryTargetMs);
+}
+
+static void TestRelaxedStall() {
+  // A relaxed route's timer may fire up to its tolerance late without being taken for a stall, so
+  // a real stall takes longer to show: the bound is the timer period and tolerance, the stall
+  // margin, a check interval and the rebuild.
+  RouteStats stats;
+  FakeRoute route(stats, kRelaxedWakeupMs, kRelaxedWakeupToleranceMs);
+  route.eventDriven = false;
+  route.Run(5000);
+  CHECK_EQ(0u, route.captureRebuilds); // late timers aren't stalls
+  route.Inject(Fault::Stall);
+  route.Run(1000);
+  uint64_t boundMs = kRelaxedWakeupMs + kRelaxedWakeupToleranceMs + RouteWatchdog::kStallMargin / kMs +
+    RouteWatchdog::kCheckIntervalMs + kCaptureActivateTime / kMs;
+  printf("relaxed capture stall: recovered in %llu ms (bound %llu ms)\n", (unsigned long long) route.RecoveryMs(),
+    (unsigned long long) boundMs);
+  CHECK_EQ(1u, route.captureRebuilds);
+  CHECK(route.RecoveryMs() > 0 && route.RecoveryMs() <= boundMs);
+}
+
+static void TestQuietSourceIsNotAStall() {
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.Run(500);
+  route.sourcePlaying = false; // no wakeups, but nothing queued either
+  route.Run(2000);
+  CHECK_EQ(0u, route.captureRebuilds + route.renderRebuilds);
+  route.sourcePlaying = true;
+  route.Run(500);
+  CHECK_EQ(0u, route.captureRebuilds);
+}
+
+static void TestBackoff() {
+  // The device is gone for two attempts. The watchdog waits kRetryDelay between them rather than
+  // retrying on every check.
+  RouteStats stats;
+  FakeRoute route(stats, 10, 0);
+  route.failingRebuilds = 2;
+  route.Run(500);
+  route.Inject(Fault::Render);
+  route.Run(400);
+  CHECK_EQ(1u, stats.failedRecoveries.load());
+  CHECK_EQ(0u, route.renderRebuilds);
+  route.Run(1000);
+  CHECK_EQ(2u, stats.failedRecoveries.load());
+  CHECK_EQ(1u, route.renderRebuilds);
+  uint64_t expectedMs = 2 * (RouteWatchdog::kRetryDelay + kRenderOpenTime) / kMs;
+  CHECK(route.RecoveryMs() >= expectedMs && route.RecoveryMs() < expectedMs + kRecoveryTargetMs);
+}
+
+int main() {
+  TestCaptureFault();
+  TestRenderFault();
+  TestRenderFormatChange();
+  TestStall();
+  TestRelaxedStall();
+  TestQuietSourceIsNotAStall();
+  TestBackoff();
+  return CheckResult();
+}
@@ -0,0 +1,267 @@
+#include "Check.h"
+#include "RtpPacketizer.h"
+#include "AudioRouterInjector/JitterBuffer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// End-to-end run of the network path over localhost UDP. A sender thread feeds a tone to
+// RtpPacketizer in 10 ms wakeups, as the capture callback does, in real time, and sends what it
+// produces on a non-blocking socket; it reorders and withholds some packets on purpose. The
+// receiver drains the socket into a JitterBuffer and plays it out in 128-frame blocks the way the
+// receiver's render loop does. Reports throughput, loss and the latency the path adds, measured
+// from a packet's send to its first frame being played.
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kChannels = 2;
+static const uint32_t kWakeupFrames = 480; // 10 ms
+static const uint32_t kWakeups = 100;      // one second
+static const uint32_t kMaxPacketFrames = RTP_MAX_PAYLOAD_SIZE / (kChannels * sizeof(int16_t));
+static const uint32_t kPackets = 2 * kWakeups; // each wakeup is a full packet and a remainder
+static const uint32_t kReorderEvery = 10; // one packet in ten goes out after the one following it
+static const uint32_t kDropEvery = 25;    // one packet in 25 is withheld, as if lost on the network
+static const uint32_t kJitterMs = 20;
+static const uint32_t kBlockFrames = 128;
+
+static int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Where each packet should start and how long it should be, relative to the first.
+static uint32_t PacketStart(uint32_t packet) {
+  return packet / 2 * kWakeupFrames + (packet % 2) * kMaxPacketFrames;
+}
+
+static uint32_t PacketFrames(uint32_t packet) {
+  return (packet % 2) ? kWakeupFrames - kMaxPacketFrames : kMaxPacketFrames;
+}
+
+// Neither touches the first or last packet, so the stream's extent is the same at both ends.
+static bool IsDropped(uint32_t packet) {
+  return packet % kDropEvery == kDropEvery / 2;
+}
+
+static bool IsDelayed(uint32_t packet) {
+  return packet % kReorderEvery == kReorderEvery / 2;
+}
+
+struct SenderResult {
+  uint32_t packetsSent = 0;
+  uint32_t packetsDropped = 0; // socket buffer full
+  uint32_t sendErrors = 0;
+  uint32_t misplaced = 0;      // packets whose timestamp or length isn't what the batching implies
+  uint64_t bytesSent = 0;
+};
+
+// Sends the packetizer's datagrams as CNetworkSink does, but withholds some and swaps others with
+// the packet after them, and checks each one's timestamp and length against the batching.
+class LoopbackSender : public RtpPacketSender {
+public:
+  LoopbackSender(int socket, std::atomic<int64_t>* sendNs, SenderResult& result) :
+    m_socket(socket), m_sendNs(sendNs), m_result(result) {}
+
+  void SendPacket(const uint8_t* packet, uint32_t size) override {
+    uint32_t index = m_packets++;
+    RtpHeader header;
+    size_t payloadOffset = 0, payloadSize = 0;
+    if (!ParseRtpHeader(packet, size, header, payloadOffset, payloadSize) || index >= kPackets) {
+      m_result.misplaced++;
+      return;
+    }
+    if (index == 0)
+      m_firstTimestamp = header.timestamp;
+    if (header.timestamp - m_firstTimestamp != PacketStart(index) || payloadSize != PacketFrames(index) * kChannels * sizeof(int16_t))
+      m_result.misplaced++;
+
+    if (IsDropped(index))
+      return;
+    if (IsDelayed(index)) {
+      m_held.assign(packet, packet + size);
+      return;
+    }
+    Send(index, packet, size);
+    if (index > 0 && IsDelayed(index - 1) && !IsDropped(index - 1))
+      Send(index - 1, m_held.data(), (uint32_t) m_held.size());
+  }
+
+private:
+  void Send(uint32_t index, const uint8_t* packet, uint32_t size) {
+    m_sendNs[index].store(NowNs(), std::memory_order_release);
+    ssize_t sent = send(m_socket, packet, size, 0);
+    if (sent == (ssize_t) size) {
+      m_result.packetsSent++;
+      m_result.bytesSent += size;
+    } else if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+      m_result.packetsDropped++;
+    } else {
+      m_result.sendErrors++;
+    }
+  }
+
+  int m_socket;
+  std::atomic<int64_t>* m_sendNs;
+  SenderResult& m_result;
+  uint32_t m_packets = 0;
+  uint32_t m_firstTimestamp = 0;
+  std::vector<uint8_t> m_held;
+};
+
+static void SenderThread(int socket, std::atomic<int64_t>* sendNs, SenderResult& result) {
+  LoopbackSender sender(socket, sendNs, result);
+  RtpPacketizer packetizer(sender);
+  if (!packetizer.Reset(kChannels, kSampleRate, true, 0x1234, 0x5eed)) {
+    result.sendErrors++;
+    return;
+  }
+  const uint64_t startQpc = 123456789; // the engine's position of the first frame, in 100ns units
+  std::vector<float> samples(kWakeupFrames * kChannels);
+  Clock::time_point start = Clock::now();
+  for (uint32_t wakeup = 0; wakeup < kWakeups; ++wakeup) {
+    std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t) wakeup * kWakeupFrames * 1000000 / kSampleRate));
+    uint32_t firstFrame = wakeup * kWakeupFrames;
+    for (uint32_t frame = 0; frame < kWakeupFrames; ++frame) {
+      float value = 0.5f * sinf(2.0f * 3.14159265f * 440.0f * (float) (firstFrame + frame) / kSampleRate);
+      for (uint32_t ch = 0; ch < kChannels; ++ch)
+        samples[frame * kChannels + ch] = value;
+    }
+    uint64_t qpcPosition = startQpc + (uint64_t) firstFrame * 10000000 / kSampleRate;
+    packetizer.Append(reinterpret_cast<const uint8_t*>(samples.data()), kWakeupFrames, qpcPosition, false);
+    packetizer.Flush();
+  }
+}
+
+int main() {
+  int receiveSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  int sendSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addressSize = sizeof(address);
+  bool connected = receiveSocket >= 0 && sendSocket >= 0 &&
+    bind(receiveSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+    getsockname(receiveSocket, reinterpret_cast<sockaddr*>(&address), &addressSize) == 0 &&
+    connect(sendSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+    fcntl(sendSocket, F_SETFL, fcntl(sendSocket, F_GETFL) | O_NONBLOCK) == 0 &&
+    fcntl(receiveSocket, F_SETFL, fcntl(receiveSocket, F_GETFL) | O_NONBLOCK) == 0;
+  CHECK(connected);
+  if (!connected)
+    return CheckResult();
+
+  std::unique_ptr<std::atomic<int64_t>[]> sendNs(new std::atomic<int64_t>[kPackets]);
+  for (uint32_t packet = 0; packet < kPackets; ++packet)
+    sendNs[packet].store(0, std::memory_order_relaxed);
+  SenderResult sender;
+  std::atomic<bool> senderDone{ false };
+  std::thread senderThread([&]() {
+    SenderThread(sendSocket, sendNs.get(), sender);
+    senderDone = true;
+  });
+
+  JitterBuffer jitterBuffer(kChannels, kSampleRate * kJitterMs / 1000, 1 << 17);
+  uint32_t packetsReceived = 0, packetsOutOfOrder = 0;
+  uint16_t expectedSequence = 0;
+  bool playing = false;
+  uint64_t framesPlayed = 0;
+  uint32_t nextPacket = 0;
+  std::vector<int64_t> latencies;
+  int16_t block[kBlockFrames * kChannels];
+  uint8_t datagram[2048];
+
+  const int64_t blockNs = (int64_t) kBlockFrames * 1000000000 / kSampleRate;
+  int64_t nextBlockNs = NowNs();
+  int64_t idleSinceNs = 0;
+  while (true) {
+    int64_t now = NowNs();
+    int timeoutMs = (nextBlockNs > now) ? (int) ((nextBlockNs - now + 999999) / 1000000) : 0;
+    pollfd readable = { receiveSocket, POLLIN, 0 };
+    poll(&readable, 1, timeoutMs);
+
+    ssize_t received;
+    while ((received = recv(receiveSocket, datagram, sizeof(datagram), 0)) > 0) {
+      RtpHeader header;
+      size_t payloadOffset = 0, payloadSize = 0;
+      if (!ParseRtpHeader(datagram, (size_t) received, header, payloadOffset, payloadSize))
+        continue;
+      if (packetsReceived > 0 && (uint16_t) (header.sequence - expectedSequence) >= 0x8000)
+        packetsOutOfOrder++;
+      else
+        expectedSequence = header.sequence + 1;
+      packetsReceived++;
+      jitterBuffer.Insert(header.timestamp, datagram + payloadOffset, (uint32_t) (payloadSize / (kChannels * sizeof(int16_t))));
+    }
+
+    now = NowNs();
+    if (now < nextBlockNs)
+      continue;
+    nextBlockNs += blockNs;
+
+    uint32_t frames = jitterBuffer.Read(block, kBlockFrames);
+    if (frames > 0) {
+      // Frames play contiguously from the first timestamp as long as nothing resyncs.
+      uint32_t timestamp = (uint32_t) framesPlayed;
+      for (; nextPacket < kPackets && PacketStart(nextPacket) < timestamp + frames; ++nextPacket) {
+        if (PacketStart(nextPacket) >= timestamp && !IsDropped(nextPacket) && sendNs[nextPacket].load(std::memory_order_acquire) != 0)
+          latencies.push_back(now - sendNs[nextPacket].load(std::memory_order_relaxed));
+      }
+      framesPlayed += frames;
+      playing = true;
+      idleSinceNs = 0;
+    } else if (senderDone && (playing || packetsReceived == 0)) {
+      if (idleSinceNs == 0)
+        idleSinceNs = now;
+      else if (now - idleSinceNs > 100000000)
+        break;
+    }
+  }
+  senderThread.join();
+  close(sendSocket);
+  close(receiveSocket);
+
+  uint32_t withheld = 0;
+  uint64_t withheldFrames = 0;
+  for (uint32_t packet = 0; packet < kPackets; ++packet) {
+    withheld += IsDropped(packet) ? 1 : 0;
+    withheldFrames += IsDropped(packet) ? PacketFrames(packet) : 0;
+  }
+  const JitterBuffer::Stats& stats = jitterBuffer.GetStats();
+  std::sort(latencies.begin(), latencies.end());
+  double seconds = (double) kWakeups * kWakeupFrames / kSampleRate;
+  int64_t medianUs = latencies.empty() ? 0 : latencies[latencies.size() / 2] / 1000;
+  int64_t maxUs = latencies.empty() ? 0 : latencies.back() / 1000;
+  printf("localhost RTP L16/%u/%u: %.1f kbit/s, %u packets sent, %u received, %u withheld, %u reordered, "
+    "%u dropped at the socket, %llu late, %llu frames concealed, %llu underruns; added latency median %lld us, "
+    "max %lld us (jitter buffer %u ms)\n", kSampleRate, kChannels, (double) sender.bytesSent * 8.0 / 1000.0 / seconds,
+    sender.packetsSent, packetsReceived, withheld, packetsOutOfOrder, sender.packetsDropped,
+    (unsigned long long) stats.latePackets, (unsigned long long) stats.concealedFrames,
+    (unsigned long long) stats.underruns, (long long) medianUs, (long long) maxUs, kJitterMs);
+
+  CHECK_EQ(0u, sender.sendErrors);
+  CHECK_EQ(0u, sender.misplaced);
+  CHECK_EQ(0u, sender.packetsDropped); // 1.5 Mbit/s never fills a local socket buffer
+  CHECK_EQ(sender.packetsSent, packetsReceived); // loopback doesn't lose datagrams
+  CHECK(packetsOutOfOrder > 0);
+  CHECK_EQ(0u, (uint32_t) stats.latePackets); // reordering stays within the jitter buffer
+  CHECK_EQ(0u, (uint32_t) stats.resyncs);
+  // Withheld packets play as silence, and nothing else does.
+  CHECK_EQ(withheldFrames, stats.concealedFrames);
+  CHECK_EQ((uint64_t) kWakeups * kWakeupFrames, framesPlayed);
+  // A packet's first frame plays about one jitter-buffer depth, less the packet's own length, after
+  // it was sent; allow generously for a loaded machine.
+  CHECK(!latencies.empty());
+  CHECK(medianUs < (int64_t) (kJitterMs * 1000 * 3));
+  return CheckResult();
+}
@@ -0,0 +1,254 @@
+#include "Check.h"
+#include "Rtp.h"
+#include "RtpPacketizer.h"
+
+#include <string.h>
+#include <vector>
+
+// Tests for the RTP header and L16 payload helpers shared by CNetworkSink and the receiver, and for
+// the packetizer CNetworkSink drives.
+
+static void TestHeaderRoundTrip() {
+  RtpHeader written;
+  written.marker = true;
+  written.sequence = 0xfedc;
+  written.timestamp = 0x89abcdefu;
+  written.ssrc = 0x01234567u;
+  uint8_t packet[RTP_HEADER_SIZE + 8] = {};
+  WriteRtpHeader(packet, written);
+  CHECK_EQ(0x80, packet[0]);
+  CHECK_EQ(0x80 | RTP_PAYLOAD_TYPE_L16, packet[1]);
+
+  RtpHeader parsed;
+  size_t payloadOffset = 0, payloadSize = 0;
+  CHECK(ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+  CHECK(parsed.marker);
+  CHECK_EQ(RTP_PAYLOAD_TYPE_L16, parsed.payloadType);
+  CHECK_EQ(0xfedc, parsed.sequence);
+  CHECK_EQ(0x89abcdefu, parsed.timestamp);
+  CHECK_EQ(0x01234567u, parsed.ssrc);
+  CHECK_EQ((size_t) RTP_HEADER_SIZE, payloadOffset);
+  CHECK_EQ((size_t) 8, payloadSize);
+}
+
+// Other senders may use CSRC lists, header extensions and padding even though ours doesn't.
+static void TestOptionalHeaderParts() {
+  std::vector<uint8_t> packet(RTP_HEADER_SIZE);
+  RtpHeader header;
+  header.sequence = 7;
+  WriteRtpHeader(packet.data(), header);
+  packet[0] |= 0x10 | 0x20 | 2; // extension, padding, two CSRCs
+  packet.insert(packet.end(), 8, 0xcc); // CSRC list
+  const uint8_t extension[] = { 0xbe, 0xde, 0x00, 0x01, 1, 2, 3, 4 }; // one 32-bit word
+  packet.insert(packet.end(), extension, extension + sizeof(extension));
+  const uint8_t payload[] = { 0x12, 0x34, 0x56, 0x78 };
+  packet.insert(packet.end(), payload, payload + sizeof(payload));
+  const uint8_t padding[] = { 0, 0, 3 };
+  packet.insert(packet.end(), padding, padding + sizeof(padding));
+
+  RtpHeader parsed;
+  size_t payloadOffset = 0, payloadSize = 0;
+  CHECK(ParseRtpHeader(packet.data(), packet.size(), parsed, payloadOffset, payloadSize));
+  CHECK_EQ(7, parsed.sequence);
+  CHECK_EQ((size_t) RTP_HEADER_SIZE + 8 + 8, payloadOffset);
+  CHECK_EQ(sizeof(payload), payloadSize);
+  CHECK(memcmp(packet.data() + payloadOffset, payload, sizeof(payload)) == 0);
+}
+
+static void TestMalformedPackets() {
+  uint8_t packet[RTP_HEADER_SIZE + 4] = {};
+  WriteRtpHeader(packet, RtpHeader());
+  RtpHeader parsed;
+  size_t payloadOffset = 0, payloadSize = 0;
+
+  CHECK(!ParseRtpHeader(packet, RTP_HEADER_SIZE - 1, parsed, payloadOffset, payloadSize));
+
+  packet[0] = 1 << 6; // version 1
+  CHECK(!ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+
+  packet[0] = (RTP_VERSION << 6) | 2; // CSRC list longer than the packet
+  CHECK(!ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+
+  packet[0] = (RTP_VERSION << 6) | 0x10; // extension header present, extension body missing
+  packet[RTP_HEADER_SIZE + 3] = 4;
+  CHECK(!ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+
+  packet[0] = (RTP_VERSION << 6) | 0x20; // more padding than packet
+  packet[sizeof(packet) - 1] = 200;
+  CHECK(!ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+
+  packet[sizeof(packet) - 1] = 4; // padding eats the whole payload, which is fine
+  CHECK(ParseRtpHeader(packet, sizeof(packet), parsed, payloadOffset, payloadSize));
+  CHECK_EQ((size_t) 0, payloadSize);
+}
+
+static void TestL16Packing() {
+  const float floats[] = { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 2.0f, -2.0f };
+  uint8_t packed[sizeof(floats) / sizeof(floats[0]) * 2];
+  FloatToL16(floats, packed, sizeof(floats) / sizeof(floats[0]));
+  const int16_t expected[] = { 0, 16383, -16383, 32767, -32767, 32767, -32768 };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+    CHECK_EQ(expected[i], (int16_t) ((packed[i * 2] << 8) | packed[i * 2 + 1]));
+  }
+
+  const int16_t samples[] = { 0x1234, -2, INT16_MIN };
+  uint8_t swapped[sizeof(samples)];
+  Int16ToL16(samples, swapped, 3);
+  const uint8_t expectedBytes[] = { 0x12, 0x34, 0xff, 0xfe, 0x80, 0x00 };
+  CHECK(memcmp(swapped, expectedBytes, sizeof(expectedBytes)) == 0);
+}
+
+// Keeps every datagram the packetizer sends, parsed.
+class RecordingSender : public RtpPacketSender {
+public:
+  struct Packet {
+    RtpHeader header;
+    std::vector<int16_t> samples;
+  };
+
+  void SendPacket(const uint8_t* packet, uint32_t size) override {
+    Packet parsed;
+    size_t payloadOffset = 0, payloadSize = 0;
+    CHECK(ParseRtpHeader(packet, size, parsed.header, payloadOffset, payloadSize));
+    for (size_t i = 0; i + 1 < payloadSize; i += 2)
+      parsed.samples.push_back((int16_t) ((packet[payloadOffset + i] << 8) | packet[payloadOffset + i + 1]));
+    packets.push_back(parsed);
+  }
+
+  std::vector<Packet> packets;
+};
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kChannels = 2;
+static const uint32_t kWakeupFrames = 480; // 10 ms
+
+// 100ns QPC position of a frame, as the engine would report it.
+static uint64_t QpcOf(uint64_t frame) {
+  return 5000000000ULL + frame * 10000000 / kSampleRate;
+}
+
+static std::vector<float> Ramp(uint32_t frames, uint32_t start) {
+  std::vector<float> samples(frames * kChannels);
+  for (uint32_t i = 0; i < samples.size(); ++i)
+    samples[i] = ((float) ((start * kChannels + i) % 1000) + 0.5f) / 32767.0f; // packs to the integer part
+  return samples;
+}
+
+static void TestPacketizerBatchesToMtu() {
+  // Each 10 ms wakeup is one full packet plus a remainder sent at Flush(), and the timestamps and
+  // payload run on across packets and wakeups.
+  RecordingSender sender;
+  RtpPacketizer packetizer(sender);
+  CHECK(packetizer.Reset(kChannels, kSampleRate, true, 0xfff0, 0x5eed));
+  uint32_t maxFrames = packetizer.MaxPacketFrames();
+  CHECK_EQ(RTP_MAX_PAYLOAD_SIZE / (kChannels * 2), maxFrames);
+  CHECK(maxFrames < kWakeupFrames);
+
+  for (uint32_t wakeup = 0; wakeup < 3; ++wakeup) {
+    std::vector<float> samples = Ramp(kWakeupFrames, wakeup * kWakeupFrames);
+    packetizer.Append(reinterpret_cast<const uint8_t*>(samples.data()), kWakeupFrames, QpcOf(wakeup * kWakeupFrames), false);
+    CHECK_EQ((size_t) (2 * wakeup + 1), sender.packets.size()); // the full packet went out straight away
+    packetizer.Flush();
+    CHECK_EQ((size_t) (2 * wakeup + 2), sender.packets.size());
+  }
+  packetizer.Flush(); // nothing pending
+  CHECK_EQ((size_t) 6, sender.packets.size());
+
+  uint32_t firstTimestamp = (uint32_t) (QpcOf(0) * kSampleRate / 10000000);
+  uint32_t frame = 0;
+  for (size_t i = 0; i < sender.packets.size(); ++i) {
+    const RecordingSender::Packet& packet = sender.packets[i];
+    uint32_t frames = (uint32_t) packet.samples.size() / kChannels;
+    CHECK_EQ((i % 2) ? kWakeupFrames - maxFrames : maxFrames, frames);
+    CHECK_EQ(i == 0, packet.header.marker);
+    CHECK_EQ((uint16_t) (0xfff0 + i), packet.header.sequence); // wraps
+    CHECK_EQ(0x5eedu, packet.header.ssrc);
+    CHECK_EQ(firstTimestamp + frame, packet.header.timestamp);
+    for (uint32_t s = 0; s < packet.samples.size(); ++s)
+      CHECK_EQ((int16_t) ((frame * kChannels + s) % 1000), packet.samples[s]);
+    frame += frames;
+  }
+}
+
+static void TestPacketizerFollowsQpc() {
+  RecordingSender sender;
+  RtpPacketizer packetizer(sender);
+  CHECK(packetizer.Reset(kChannels, kSampleRate, true, 0, 1));
+  std::vector<float> samples = Ramp(kWakeupFrames, 0);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(samples.data());
+
+  // Positions that wander by less than a millisecond (rounding, a late wakeup) don't move the
+  // timestamps: the stream stays contiguous.
+  packetizer.Append(data, kWakeupFrames, QpcOf(0), false);
+  packetizer.Flush();
+  packetizer.Append(data, kWakeupFrames, QpcOf(kWakeupFrames + 40), false);
+  packetizer.Flush();
+  packetizer.Append(data, kWakeupFrames, QpcOf(2 * kWakeupFrames - 40), false);
+  packetizer.Flush();
+  uint32_t anchor = (uint32_t) (QpcOf(0) * kSampleRate / 10000000);
+  CHECK_EQ((size_t) 6, sender.packets.size());
+  CHECK_EQ(anchor + kWakeupFrames, sender.packets[2].header.timestamp);
+  CHECK_EQ(anchor + 2 * kWakeupFrames, sender.packets[4].header.timestamp);
+
+  // A gap of more than a millisecond (a glitch in the capture) re-anchors to the engine's position,
+  // so the receiver sees the gap instead of the audio arriving early. The partial packet from
+  // before the gap goes out first with its own timestamp.
+  sender.packets.clear();
+  packetizer.Append(data, 100, QpcOf(3 * kWakeupFrames), false);
+  CHECK(sender.packets.empty());
+  uint32_t gapFrame = 3 * kWakeupFrames + 100 + kSampleRate / 1000 + 2;
+  packetizer.Append(data, 100, QpcOf(gapFrame), false);
+  CHECK_EQ((size_t) 1, sender.packets.size());
+  packetizer.Flush();
+  CHECK_EQ((size_t) 2, sender.packets.size());
+  CHECK_EQ(anchor + 3 * kWakeupFrames, sender.packets[0].header.timestamp);
+  CHECK_EQ((size_t) 100 * kChannels, sender.packets[0].samples.size());
+  CHECK_EQ(anchor + gapFrame, sender.packets[1].header.timestamp);
+
+  // Going backwards by more than a millisecond (a restarted stream) re-anchors the same way.
+  sender.packets.clear();
+  packetizer.Append(data, 100, QpcOf(0), false);
+  packetizer.Flush();
+  CHECK_EQ((size_t) 1, sender.packets.size());
+  CHECK_EQ(anchor, sender.packets[0].header.timestamp);
+  CHECK(!sender.packets[0].header.marker); // only the first packet of the stream is marked
+}
+
+static void TestPacketizerFormats() {
+  RecordingSender sender;
+  RtpPacketizer packetizer(sender);
+
+  // Silent packets are sent as zeros, whatever the buffer holds.
+  CHECK(packetizer.Reset(kChannels, kSampleRate, true, 0, 1));
+  std::vector<float> samples = Ramp(10, 1);
+  packetizer.Append(reinterpret_cast<const uint8_t*>(samples.data()), 10, QpcOf(0), true);
+  packetizer.Flush();
+  CHECK_EQ((size_t) 1, sender.packets.size());
+  CHECK_EQ(std::vector<int16_t>(10 * kChannels, 0), sender.packets[0].samples);
+
+  // 16-bit PCM is only byte-swapped; a mono stream packs twice the frames per packet.
+  sender.packets.clear();
+  CHECK(packetizer.Reset(1, kSampleRate, false, 0, 1));
+  CHECK_EQ(RTP_MAX_PAYLOAD_SIZE / 2, packetizer.MaxPacketFrames());
+  const int16_t pcm[] = { 1, -1, INT16_MAX, INT16_MIN };
+  packetizer.Append(reinterpret_cast<const uint8_t*>(pcm), 4, QpcOf(0), false);
+  packetizer.Flush();
+  CHECK_EQ((size_t) 1, sender.packets.size());
+  CHECK_EQ(std::vector<int16_t>(pcm, pcm + 4), sender.packets[0].samples);
+  CHECK(sender.packets[0].header.marker); // a new stream starts marked
+
+  // More channels than fit one frame in a packet can't be streamed.
+  CHECK(!packetizer.Reset(RTP_MAX_PAYLOAD_SIZE, kSampleRate, true, 0, 1));
+  CHECK(!packetizer.Reset(0, kSampleRate, true, 0, 1));
+}
+
+int main() {
+  TestHeaderRoundTrip();
+  TestOptionalHeaderParts();
+  TestMalformedPackets();
+  TestL16Packing();
+  TestPacketizerBatchesToMtu();
+  TestPacketizerFollowsQpc();
+  TestPacketizerFormats();
+  return CheckResult();
+}
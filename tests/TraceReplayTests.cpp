@@ -0,0 +1,130 @@
+#include "Check.h"
+#include "TraceReplay.h"
+
+#include <vector>
+
+// Replays synthetic traces through the routing pipeline and checks the glitches it reports: a
+// healthy route reports none, overflows, underruns and discontinuities are each counted, and the
+// simulated render queue keeps its own depth rather than taking the recorded one.
+
+static const uint32_t kSampleRate = 48000;
+static const uint32_t kPacketFrames = 480; // 10 ms
+static const uint64_t kWakeupInterval = 100000; // 10 ms in 100ns units
+
+struct TraceBuilder {
+  explicit TraceBuilder(uint32_t renderBufferFrames) : writer(1 << 20, MakeFormat(renderBufferFrames)) {}
+
+  static PacketTraceFormat MakeFormat(uint32_t renderBufferFrames) {
+    PacketTraceFormat format;
+    format.sampleRate = kSampleRate;
+    format.channels = 2;
+    format.captureBufferFrames = 4800;
+    format.renderBufferFrames = renderBufferFrames;
+    return format;
+  }
+
+  // One wakeup that finds `packets` packets waiting.
+  void Wakeup(uint32_t renderPadding, uint32_t packets = 1, uint32_t flags = 0) {
+    qpc += kWakeupInterval;
+    writer.RecordWakeup(qpc, renderPadding);
+    for (uint32_t i = 0; i < packets; ++i) {
+      writer.RecordPacket(kPacketFrames, flags, devicePosition, qpc - kWakeupInterval);
+      devicePosition += kPacketFrames;
+    }
+  }
+
+  PacketTraceReplayResult Replay() {
+    writer.Serialize(bytes);
+    PacketTraceReader reader;
+    PacketTraceReplayResult result;
+    CHECK(reader.Open(bytes.data(), bytes.size()));
+    ReplayPacketTrace(reader, result);
+    return result;
+  }
+
+  PacketTraceWriter writer;
+  std::vector<uint8_t> bytes;
+  uint64_t qpc = 1000000;
+  uint64_t devicePosition = 0;
+};
+
+static void TestHealthyRenderTrace() {
+  TraceBuilder trace(1920);
+  for (int i = 0; i < 500; ++i)
+    trace.Wakeup(960);
+  PacketTraceReplayResult result = trace.Replay();
+  CHECK_EQ(500u, result.wakeups);
+  CHECK_EQ(500u, result.packets);
+  CHECK_EQ(500u * kPacketFrames, result.frames);
+  CHECK_EQ(0u, result.renderOverflows);
+  CHECK_EQ(0u, result.renderUnderruns);
+  CHECK_EQ(0u, result.devicePositionGaps);
+  CHECK_EQ(0u, result.paddingMismatches);
+  CHECK_EQ(960u, result.minRenderPadding);
+  CHECK_EQ(10000u, result.maxWakeupIntervalUs);
+}
+
+static void TestRenderGlitches() {
+  TraceBuilder trace(1920);
+  for (int i = 0; i < 10; ++i)
+    trace.Wakeup(960);
+  // A late wakeup finds the queue drained, then a burst of packets that can't all fit.
+  trace.Wakeup(0, 5);
+  trace.Wakeup(960, 1, PACKET_TRACE_FLAG_DATA_DISCONTINUITY);
+  trace.Wakeup(960, 1, PACKET_TRACE_FLAG_SILENT);
+  PacketTraceReplayResult result = trace.Replay();
+  CHECK_EQ(1u, result.renderUnderruns);
+  CHECK_EQ(1u, result.renderOverflows); // 0 + 4 * 480 fits in 1920; the fifth doesn't
+  CHECK_EQ(1u, result.discontinuities);
+  CHECK_EQ(1u, result.silentPackets);
+  CHECK_EQ(0u, result.minRenderPadding);
+  CHECK_EQ(0u, result.paddingMismatches); // the simulation followed the recording through all of it
+}
+
+static void TestSimulatedQueueKeepsItsOwnDepth() {
+  // Partway through, the recorded queue is 480 frames deeper than the packets account for, as if
+  // the render device had been reopened with more pre-roll. The simulated queue doesn't jump with
+  // it: it keeps draining by what the device played, and every wakeup from then on is counted as a
+  // mismatch.
+  TraceBuilder trace(2880);
+  for (int i = 0; i < 10; ++i)
+    trace.Wakeup(960);
+  for (int i = 0; i < 20; ++i)
+    trace.Wakeup(1920);
+  PacketTraceReplayResult result = trace.Replay();
+  CHECK_EQ(20u, result.paddingMismatches);
+  CHECK_EQ(0u, result.renderUnderruns);
+  CHECK_EQ(0u, result.renderOverflows);
+  CHECK_EQ(960u, result.minRenderPadding);
+
+  // A recorded queue that is lower than the packets account for was played out: the device ran
+  // it dry, and each wakeup that finds it empty is an underrun in the simulation too.
+  TraceBuilder reset(1920);
+  for (int i = 0; i < 10; ++i)
+    reset.Wakeup(960);
+  reset.Wakeup(0);
+  reset.Wakeup(0);
+  result = reset.Replay();
+  CHECK_EQ(2u, result.renderUnderruns);
+  CHECK_EQ(0u, result.paddingMismatches);
+}
+
+static void TestNetworkTrace() {
+  // A streamed route has no render queue, so its trace records no padding and no render buffer.
+  TraceBuilder trace(0);
+  for (int i = 0; i < 500; ++i)
+    trace.Wakeup(0, (i % 50 == 0) ? 3 : 1);
+  PacketTraceReplayResult result = trace.Replay();
+  CHECK_EQ(0u, result.renderUnderruns);
+  CHECK_EQ(0u, result.renderOverflows);
+  CHECK_EQ(result.frames, result.streamedFrames);
+  CHECK_EQ(520u * kPacketFrames, result.streamedFrames);
+}
+
+int main() {
+  TestHealthyRenderTrace();
+  TestRenderGlitches();
+  TestSimulatedQueueKeepsItsOwnDepth();
+  TestNetworkTrace();
+  return CheckResult();
+}
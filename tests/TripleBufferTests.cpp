@@ -0,0 +1,90 @@
+#include "Check.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <thread>
+
+// The parameter handoff between the control channel and the audio thread: the consumer sees only
+// whole values, never goes back to an older one, and skips straight to the latest.
+
+struct Params {
+  uint64_t sequence = 0;
+  uint64_t check[7] = {}; // each sequence * (i + 1), so a torn read shows
+};
+
+static void Fill(Params& params, uint64_t sequence) {
+  params.sequence = sequence;
+  for (int i = 0; i < 7; ++i)
+    params.check[i] = sequence * (i + 1);
+}
+
+static bool IsWhole(const Params& params) {
+  for (int i = 0; i < 7; ++i) {
+    if (params.check[i] != params.sequence * (i + 1))
+      return false;
+  }
+  return true;
+}
+
+static void TestSingleThreaded() {
+  TripleBuffer<Params> handoff;
+  CHECK(!handoff.Consume()); // nothing published yet
+  CHECK_EQ(0u, handoff.Front().sequence);
+
+  Fill(handoff.Back(), 1);
+  handoff.Publish();
+  CHECK(handoff.Consume());
+  CHECK_EQ(1u, handoff.Front().sequence);
+  CHECK(!handoff.Consume()); // already taken
+  CHECK_EQ(1u, handoff.Front().sequence);
+
+  // Several publishes between two block boundaries: only the latest is seen.
+  for (uint64_t sequence = 2; sequence <= 5; ++sequence) {
+    Fill(handoff.Back(), sequence);
+    handoff.Publish();
+  }
+  CHECK(handoff.Consume());
+  CHECK_EQ(5u, handoff.Front().sequence);
+  CHECK(IsWhole(handoff.Front()));
+  CHECK(!handoff.Consume());
+}
+
+static void TestConcurrent() {
+  const uint64_t kPublishes = 200000;
+  TripleBuffer<Params> handoff;
+  std::atomic<bool> done{ false };
+
+  std::thread producer([&]() {
+    for (uint64_t sequence = 1; sequence <= kPublishes; ++sequence) {
+      Fill(handoff.Back(), sequence);
+      handoff.Publish();
+    }
+    done = true;
+  });
+
+  uint64_t consumed = 0, lastSequence = 0, torn = 0, backwards = 0;
+  auto consume = [&]() {
+    if (!handoff.Consume())
+      return;
+    const Params& front = handoff.Front();
+    consumed++;
+    torn += IsWhole(front) ? 0 : 1;
+    backwards += (front.sequence <= lastSequence) ? 1 : 0;
+    lastSequence = front.sequence;
+  };
+  while (!done.load())
+    consume();
+  producer.join();
+  consume(); // whatever was published last
+
+  CHECK(consumed > 0);
+  CHECK_EQ(0u, torn);
+  CHECK_EQ(0u, backwards);
+  CHECK_EQ(kPublishes, lastSequence);
+}
+
+int main() {
+  TestSingleThreaded();
+  TestConcurrent();
+  return CheckResult();
+}